@@ -0,0 +1,180 @@
+#include "clustered_lighting.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "job_system.h"
+
+/* Clustered Lighting */
+
+ClusteredLighting::ClusteredLighting(JobSystem * jobs, int tiles_x, int tiles_y, int depth_slices)
+	: tiles_x(tiles_x), tiles_y(tiles_y), depth_slices(depth_slices),
+	bounds_fov_y(0.f), bounds_aspect(0.f), bounds_near(0.f), bounds_far(0.f),
+	cluster_lights(size_t(tiles_x) * tiles_y * depth_slices), jobs(jobs)
+{
+	const auto create_texture_buffer = [](GLuint& buffer, GLuint& texture, GLenum format)
+	{
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+	};
+	create_texture_buffer(grid_buffer, grid_texture, GL_RG32UI);
+	create_texture_buffer(light_index_buffer, light_index_texture, GL_R32UI);
+	create_texture_buffer(light_data_buffer, light_data_texture, GL_RGBA32F);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	// No lights until the first Build
+	block = ClusteredLightsBlock();
+
+	glGenBuffers(1, &uniform_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusteredLightsBlock), &block, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, uniform_block_binding, uniform_buffer);
+}
+
+void ClusteredLighting::SetupProgram(GLuint program) const
+{
+	GLuint block_index = glGetUniformBlockIndex(program, "ClusteredLights");
+	if (block_index != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, block_index, uniform_block_binding);
+
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "u_cluster_grid"), grid_unit);
+	glUniform1i(glGetUniformLocation(program, "u_cluster_light_indices"), light_index_unit);
+	glUniform1i(glGetUniformLocation(program, "u_light_data"), light_data_unit);
+}
+
+void ClusteredLighting::Bind() const
+{
+	glActiveTexture(GL_TEXTURE0 + grid_unit);
+	glBindTexture(GL_TEXTURE_BUFFER, grid_texture);
+	glActiveTexture(GL_TEXTURE0 + light_index_unit);
+	glBindTexture(GL_TEXTURE_BUFFER, light_index_texture);
+	glActiveTexture(GL_TEXTURE0 + light_data_unit);
+	glBindTexture(GL_TEXTURE_BUFFER, light_data_texture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void ClusteredLighting::Build(const glm::mat4& view, float fov_y_radians, float aspect, float near_depth, float far_depth)
+{
+	if (fov_y_radians != bounds_fov_y || aspect != bounds_aspect || near_depth != bounds_near || far_depth != bounds_far)
+		ComputeBounds(fov_y_radians, aspect, near_depth, far_depth);
+
+	// Into (x, y, depth) once here, the bands only read this. The view is left-handed, depth is +z
+	view_space_lights.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); ++i)
+	{
+		auto position = view * glm::vec4(lights[i].position, 1.f);
+		view_space_lights[i] = glm::vec3(position);
+	}
+
+	// Bands of whole depth slices, so no two of them touch the same cluster
+	if (jobs != NULL)
+		jobs->ParallelFor("Bin slices", size_t(depth_slices), 1, [this](size_t begin, size_t end) { BinSlices(int(begin), int(end)); });
+	else
+		BinSlices(0, depth_slices);
+
+	grid.resize(cluster_lights.size() * 2);
+	light_indices.clear();
+	for (size_t cluster = 0; cluster < cluster_lights.size(); ++cluster)
+	{
+		grid[cluster * 2] = uint32_t(light_indices.size());
+		grid[cluster * 2 + 1] = uint32_t(cluster_lights[cluster].size());
+		light_indices.insert(light_indices.end(), cluster_lights[cluster].begin(), cluster_lights[cluster].end());
+	}
+
+	auto inverse_view = glm::inverse(view);
+	block.camera_position = inverse_view[3];
+	block.camera_forward = inverse_view[2];
+	block.grid = glm::vec4(tiles_x, tiles_y, depth_slices, lights.size());
+	block.depth = glm::vec4(near_depth, far_depth, depth_slices / std::log(far_depth / near_depth), 0.f);
+}
+
+void ClusteredLighting::Upload(int screen_width, int screen_height)
+{
+	// Fresh storage every frame so the driver never waits for last frame's draws
+	const auto upload = [](GLuint buffer, const void * data, size_t size)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(size, 16), NULL, GL_STREAM_DRAW);
+		if (size != 0)
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+	};
+	upload(grid_buffer, grid.data(), grid.size() * sizeof(uint32_t));
+	upload(light_index_buffer, light_indices.data(), light_indices.size() * sizeof(uint32_t));
+	upload(light_data_buffer, lights.data(), lights.size() * sizeof(ClusteredLight));
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	block.screen = glm::vec4(screen_width, screen_height, 0.f, 0.f);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ClusteredLightsBlock), &block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void ClusteredLighting::ComputeBounds(float fov_y_radians, float aspect, float near_depth, float far_depth)
+{
+	bounds_fov_y = fov_y_radians;
+	bounds_aspect = aspect;
+	bounds_near = near_depth;
+	bounds_far = far_depth;
+
+	float tan_half_y = std::tan(fov_y_radians / 2.f);
+	float tan_half_x = tan_half_y * aspect;
+
+	bounds.resize(cluster_lights.size());
+	for (int z = 0; z < depth_slices; ++z)
+	{
+		float slice_near = near_depth * std::pow(far_depth / near_depth, float(z) / depth_slices);
+		float slice_far = near_depth * std::pow(far_depth / near_depth, float(z + 1) / depth_slices);
+
+		for (int y = 0; y < tiles_y; ++y)
+			for (int x = 0; x < tiles_x; ++x)
+			{
+				float ndc_x0 = 2.f * x / tiles_x - 1.f, ndc_x1 = 2.f * (x + 1) / tiles_x - 1.f;
+				float ndc_y0 = 2.f * y / tiles_y - 1.f, ndc_y1 = 2.f * (y + 1) / tiles_y - 1.f;
+
+				// The cluster widens with depth, its box spans the near and far faces
+				auto& box = bounds[(size_t(z) * tiles_y + y) * tiles_x + x];
+				box.min = glm::vec3(std::min(ndc_x0 * slice_near, ndc_x0 * slice_far) * tan_half_x,
+					std::min(ndc_y0 * slice_near, ndc_y0 * slice_far) * tan_half_y, slice_near);
+				box.max = glm::vec3(std::max(ndc_x1 * slice_near, ndc_x1 * slice_far) * tan_half_x,
+					std::max(ndc_y1 * slice_near, ndc_y1 * slice_far) * tan_half_y, slice_far);
+			}
+	}
+}
+
+void ClusteredLighting::BinSlices(int first_slice, int end_slice)
+{
+	size_t slice_size = size_t(tiles_x) * tiles_y;
+	for (size_t cluster = first_slice * slice_size; cluster < end_slice * slice_size; ++cluster)
+		cluster_lights[cluster].clear();
+
+	for (uint32_t light = 0; light < lights.size(); ++light)
+	{
+		const auto& center = view_space_lights[light];
+		float range = lights[light].range;
+
+		for (int z = first_slice; z < end_slice; ++z)
+		{
+			const auto& slice_box = bounds[z * slice_size];
+			if (center.z + range < slice_box.min.z || center.z - range > slice_box.max.z)
+				continue;
+
+			for (size_t cluster = z * slice_size; cluster < (z + 1) * slice_size; ++cluster)
+			{
+				// Closest point of the box to the light
+				const auto& box = bounds[cluster];
+				glm::vec3 closest = glm::clamp(center, box.min, box.max);
+				glm::vec3 offset = closest - center;
+				if (glm::dot(offset, offset) <= range * range)
+					cluster_lights[cluster].push_back(light);
+			}
+		}
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glad/glad.h"
+
+struct JobSystem;
+
+/* Clustered Lighting Structs */
+
+// Three RGBA32F texels in the light buffer, world space
+struct ClusteredLight
+{
+	glm::vec3 position;
+	float range;
+	glm::vec3 color;
+	float cos_outer_cone; // -1 for a point light
+	glm::vec3 direction;  // spot lights only
+	float padding;
+};
+
+// Matches the std140 "ClusteredLights" block in the scene fragment shader
+struct ClusteredLightsBlock
+{
+	glm::vec4 camera_position;
+	glm::vec4 camera_forward;
+	glm::vec4 grid;   // tiles x, tiles y, depth slices, light count
+	glm::vec4 depth;  // near, far, slices / log(far / near)
+	glm::vec4 screen; // width, height
+};
+
+// View-space box of one cluster, in (x, y, depth) with depth increasing away from the camera
+struct ClusterBounds
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// Clustered forward shading. The view frustum is cut into tiles_x * tiles_y screen tiles and
+// depth_slices exponential depth slices; every cluster gets the list of lights whose range
+// reaches into it, so a fragment only loops over the lights near it. Build bins on the job
+// system, in bands of whole depth slices, Upload sends the results to the GPU as texture buffers.
+struct ClusteredLighting
+{
+	static const int grid_unit = 4;
+	static const int light_index_unit = 5;
+	static const int light_data_unit = 6;
+	static const GLuint uniform_block_binding = 1;
+
+	int tiles_x;
+	int tiles_y;
+	int depth_slices;
+
+	// Filled by the caller every frame before Build
+	std::vector<ClusteredLight> lights;
+
+	std::vector<ClusterBounds> bounds;
+	float bounds_fov_y;
+	float bounds_aspect;
+	float bounds_near;
+	float bounds_far;
+
+	// Per cluster light lists written by the bands, flattened into offsets and indices for upload
+	std::vector<std::vector<uint32_t>> cluster_lights;
+	std::vector<glm::vec3> view_space_lights;
+	std::vector<uint32_t> grid;
+	std::vector<uint32_t> light_indices;
+
+	GLuint grid_buffer, grid_texture;
+	GLuint light_index_buffer, light_index_texture;
+	GLuint light_data_buffer, light_data_texture;
+	GLuint uniform_buffer;
+
+	ClusteredLightsBlock block;
+
+	JobSystem * jobs; // NULL bins on the calling thread
+
+	ClusteredLighting(JobSystem * jobs = NULL, int tiles_x = 16, int tiles_y = 16, int depth_slices = 24);
+
+	ClusteredLighting(const ClusteredLighting&) = delete;
+	ClusteredLighting& operator=(const ClusteredLighting&) = delete;
+
+	void SetupProgram(GLuint program) const;
+	void Bind() const;
+
+	// Bins "lights" for this camera, no GL calls so it can run as a job
+	void Build(const glm::mat4& view, float fov_y_radians, float aspect, float near_depth, float far_depth);
+
+	// Sends the last Build to the GPU, on the thread that owns the GL context
+	void Upload(int screen_width, int screen_height);
+
+	void ComputeBounds(float fov_y_radians, float aspect, float near_depth, float far_depth);
+	void BinSlices(int first_slice, int end_slice);
+};
@@ -0,0 +1,62 @@
+/* Offline texture cooker: converts a source image into a BC1 .mtex container with all mips precomputed,
+   or with --virtual into a tiled .vtex pyramid for virtual texturing.
+   Usage: cook_texture [--virtual] <input image> <output> */
+
+#include <iostream>
+#include <string>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "texture_container.h"
+#include "texture_cooking.h"
+
+int main(int argc, char ** argv)
+{
+	bool virtual_texture = argc == 4 && std::string(argv[1]) == "--virtual";
+	if (argc != 3 && !virtual_texture)
+	{
+		std::cout << "Usage: " << argv[0] << " [--virtual] <input image> <output>" << std::endl;
+		return -1;
+	}
+	const char * input = argv[argc - 2];
+	const char * output = argv[argc - 1];
+
+	// Same orientation as the textures loaded in main.cpp
+	stbi_set_flip_vertically_on_load(true);
+
+	RGBImage image;
+	int channels;
+	unsigned char * data = stbi_load(input, &image.width, &image.height, &channels, 3);
+	if (data == NULL)
+	{
+		std::cout << "Error: " << input << " failed to load: " << stbi_failure_reason() << std::endl;
+		return -1;
+	}
+	image.pixels.assign(data, data + size_t(image.width) * image.height * 3);
+	stbi_image_free(data);
+
+	if (virtual_texture)
+	{
+		if (!WriteVirtualTextureFile(output, image))
+			return -1;
+
+		std::cout << "Cooked " << input << " (" << image.width << "x" << image.height << ") into virtual texture " << output << std::endl;
+		return 0;
+	}
+
+	auto mips = GenerateMipChain(image);
+	if (!WriteTextureContainer(output, mips))
+		return -1;
+
+	size_t source_size = 0, cooked_size = 0;
+	for (const auto& mip : mips)
+	{
+		source_size += mip.pixels.size();
+		cooked_size += CompressedMipSize(GL_COMPRESSED_RGB_S3TC_DXT1_EXT, mip.width, mip.height);
+	}
+
+	std::cout << "Cooked " << input << " (" << image.width << "x" << image.height << ", " << mips.size() << " mips) into " << output
+		<< ", " << cooked_size << " bytes of BC1 instead of " << source_size << " bytes of RGB" << std::endl;
+	return 0;
+}
@@ -0,0 +1,174 @@
+#include "cpu_profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+/* CPU Profiler */
+
+namespace
+{
+	// Function-local so zones recorded during static initialization still find them
+	std::mutex& RegistryMutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	std::vector<std::unique_ptr<CpuProfileThreadBuffer>>& Registry()
+	{
+		static std::vector<std::unique_ptr<CpuProfileThreadBuffer>> buffers;
+		return buffers;
+	}
+
+	// Counter samples of all threads in one ring, under the registry lock
+	const size_t counter_capacity = 1 << 16;
+	std::vector<CpuProfileCounter>& Counters()
+	{
+		static std::vector<CpuProfileCounter> counters;
+		return counters;
+	}
+	uint64_t counter_count = 0;
+}
+
+CpuProfileThreadBuffer::CpuProfileThreadBuffer(uint32_t thread_id)
+	: thread_id(thread_id), events(new CpuProfileSlot[capacity]), started(0), count(0)
+{
+	for (size_t i = 0; i < capacity; ++i)
+	{
+		events[i].name.store(NULL, std::memory_order_relaxed);
+		events[i].begin_ns.store(0, std::memory_order_relaxed);
+		events[i].end_ns.store(0, std::memory_order_relaxed);
+	}
+	open_zones.reserve(32);
+}
+
+int64_t CpuProfiler::Now()
+{
+	static const auto epoch = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+CpuProfileThreadBuffer& CpuProfiler::ThreadBuffer()
+{
+	// The registry owns the buffer, the thread only caches where it is
+	thread_local CpuProfileThreadBuffer * buffer = NULL;
+	if (buffer == NULL)
+	{
+		std::lock_guard<std::mutex> lock(RegistryMutex());
+		auto& registry = Registry();
+		registry.emplace_back(new CpuProfileThreadBuffer(uint32_t(registry.size())));
+		buffer = registry.back().get();
+		buffer->thread_name = "Thread " + std::to_string(buffer->thread_id);
+	}
+	return *buffer;
+}
+
+void CpuProfiler::BeginZone(const char * name)
+{
+	ThreadBuffer().open_zones.push_back({ name, Now(), 0 });
+}
+
+void CpuProfiler::EndZone()
+{
+	auto& buffer = ThreadBuffer();
+	if (buffer.open_zones.empty())
+		return;
+
+	CpuProfileEvent event = buffer.open_zones.back();
+	buffer.open_zones.pop_back();
+	event.end_ns = Now();
+
+	// Oldest events are overwritten once the ring is full
+	// A reader that sees any of the new slot values also sees "started" cover it, through the fences
+	uint64_t index = buffer.count.load(std::memory_order_relaxed);
+	buffer.started.store(index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	auto& slot = buffer.events[index % CpuProfileThreadBuffer::capacity];
+	slot.name.store(event.name, std::memory_order_relaxed);
+	slot.begin_ns.store(event.begin_ns, std::memory_order_relaxed);
+	slot.end_ns.store(event.end_ns, std::memory_order_relaxed);
+	buffer.count.store(index + 1, std::memory_order_release);
+}
+
+void CpuProfiler::SetThreadName(const char * name)
+{
+	auto& buffer = ThreadBuffer();
+	std::lock_guard<std::mutex> lock(RegistryMutex());
+	buffer.thread_name = name;
+}
+
+void CpuProfiler::RecordCounter(const char * name, double value)
+{
+	CpuProfileCounter sample = { name, Now(), value };
+	std::lock_guard<std::mutex> lock(RegistryMutex());
+	auto& counters = Counters();
+	if (counters.size() < counter_capacity)
+		counters.push_back(sample);
+	else
+		counters[counter_count % counter_capacity] = sample;
+	counter_count++;
+}
+
+bool CpuProfiler::WriteChromeTrace(const std::string& path)
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		std::cout << "Error: Could not write CPU trace " << path << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(RegistryMutex());
+
+	// Zone and thread names are our own string literals, nothing in them needs escaping
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	size_t written = 0;
+	std::vector<CpuProfileEvent> events;
+	for (const auto& buffer : Registry())
+	{
+		file << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_id
+			<< ",\"args\":{\"name\":\"" << buffer->thread_name << "\"}}";
+		first = false;
+
+		// A thread still recording may lap the ring while we copy, whatever it could have overwritten is dropped
+		uint64_t end = buffer->count.load(std::memory_order_acquire);
+		uint64_t begin = end > CpuProfileThreadBuffer::capacity ? end - CpuProfileThreadBuffer::capacity : 0;
+		events.clear();
+		for (uint64_t i = begin; i < end; ++i)
+		{
+			const auto& slot = buffer->events[i % CpuProfileThreadBuffer::capacity];
+			events.push_back({ slot.name.load(std::memory_order_relaxed), slot.begin_ns.load(std::memory_order_relaxed),
+				slot.end_ns.load(std::memory_order_relaxed) });
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t started = buffer->started.load(std::memory_order_relaxed);
+		uint64_t overwritten = started > CpuProfileThreadBuffer::capacity ? started - CpuProfileThreadBuffer::capacity : 0;
+		size_t skip = size_t(std::min<uint64_t>(overwritten > begin ? overwritten - begin : 0, events.size()));
+
+		file << std::fixed << std::setprecision(3);
+		for (size_t i = skip; i < events.size(); ++i)
+		{
+			const auto& event = events[i];
+			file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+				<< ",\"ts\":" << event.begin_ns / 1000.0 << ",\"dur\":" << (event.end_ns - event.begin_ns) / 1000.0 << "}";
+		}
+		written += events.size() - skip;
+	}
+
+	const auto& counters = Counters();
+	for (uint64_t i = counter_count - counters.size(); i < counter_count; ++i)
+	{
+		const auto& sample = counters[i % counter_capacity];
+		file << ",\n{\"name\":\"" << sample.name << "\",\"cat\":\"cpu\",\"ph\":\"C\",\"pid\":1,\"ts\":" << sample.time_ns / 1000.0
+			<< ",\"args\":{\"value\":" << sample.value << "}}";
+	}
+	file << "\n]}\n";
+
+	std::cout << "CPU trace with " << written << " zones written to " << path << std::endl;
+	return bool(file);
+}
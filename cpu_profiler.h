@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* CPU Profiler Switch */
+
+// Zones are recorded in debug builds, release builds only with -DMARS_PROFILING. Without it the
+// PROFILE_* macros compile to nothing and the zone names never reach the binary.
+#if !defined(MARS_PROFILING) && !defined(NDEBUG)
+#define MARS_PROFILING 1
+#endif
+
+#define MARS_PROFILE_CONCAT_(a, b) a##b
+#define MARS_PROFILE_CONCAT(a, b) MARS_PROFILE_CONCAT_(a, b)
+
+#if defined(MARS_PROFILING) && MARS_PROFILING
+#define PROFILE_ZONE(name) CpuProfileZone MARS_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_BEGIN(name) CpuProfiler::BeginZone(name)
+#define PROFILE_END() CpuProfiler::EndZone()
+#define PROFILE_THREAD_NAME(name) CpuProfiler::SetThreadName(name)
+#define PROFILE_COUNTER(name, value) CpuProfiler::RecordCounter(name, value)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_BEGIN(name) ((void)0)
+#define PROFILE_END() ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#endif
+
+/* CPU Profiler Structs */
+
+struct CpuProfileEvent
+{
+	const char * name; // string literal, only the pointer is stored
+	int64_t begin_ns;
+	int64_t end_ns;
+};
+
+// A value over time, such as a utilization, shown as a graph above the threads
+struct CpuProfileCounter
+{
+	const char * name; // string literal, only the pointer is stored
+	int64_t time_ns;
+	double value;
+};
+
+// A ring slot, read while the owning thread may be overwriting it, so every field is atomic
+struct CpuProfileSlot
+{
+	std::atomic<const char *> name;
+	std::atomic<int64_t> begin_ns;
+	std::atomic<int64_t> end_ns;
+};
+
+// One per thread that ever recorded a zone, kept until exit so finished threads still show up in traces.
+// Only the owning thread writes: it bumps "started" before touching a slot, fills it and then publishes
+// it by bumping "count" with release order. Readers load "count" with acquire, copy the slots before it
+// and afterwards drop whatever "started" says may have been overwritten meanwhile.
+struct CpuProfileThreadBuffer
+{
+	static const size_t capacity = 1 << 16;
+
+	uint32_t thread_id;
+	std::string thread_name; // under the registry lock
+
+	std::unique_ptr<CpuProfileSlot[]> events;
+	std::atomic<uint64_t> started;
+	std::atomic<uint64_t> count;
+
+	// Begun but not ended yet, owning thread only
+	std::vector<CpuProfileEvent> open_zones;
+
+	CpuProfileThreadBuffer(uint32_t thread_id);
+};
+
+struct CpuProfiler
+{
+	static void BeginZone(const char * name);
+	static void EndZone();
+
+	static void SetThreadName(const char * name);
+
+	// Meant for a few values per frame, from any thread
+	static void RecordCounter(const char * name, double value);
+
+	// Chrome trace_event JSON of everything still in the thread rings, opens in chrome://tracing or Perfetto
+	static bool WriteChromeTrace(const std::string& path);
+
+	// Nanoseconds since the first call
+	static int64_t Now();
+
+	// The calling thread's buffer, registered on first use
+	static CpuProfileThreadBuffer& ThreadBuffer();
+};
+
+// Zone for the rest of the enclosing block, use PROFILE_ZONE rather than naming one directly
+struct CpuProfileZone
+{
+	CpuProfileZone(const char * name) { CpuProfiler::BeginZone(name); }
+	~CpuProfileZone() { CpuProfiler::EndZone(); }
+
+	CpuProfileZone(const CpuProfileZone&) = delete;
+	CpuProfileZone& operator=(const CpuProfileZone&) = delete;
+};
@@ -0,0 +1,246 @@
+#include "culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "software_occlusion.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define CULLING_SSE 1
+#endif
+
+/* Culling Set */
+
+void CullingSet::Clear()
+{
+	x.clear();
+	y.clear();
+	z.clear();
+	radius.clear();
+	visible.clear();
+}
+
+size_t CullingSet::Add(const BoundingSphere& sphere)
+{
+	x.push_back(sphere.center.x);
+	y.push_back(sphere.center.y);
+	z.push_back(sphere.center.z);
+	radius.push_back(sphere.radius);
+	visible.push_back(1);
+	return x.size() - 1;
+}
+
+void CullingSet::Resize(size_t count)
+{
+	x.resize(count);
+	y.resize(count);
+	z.resize(count);
+	radius.resize(count);
+	visible.assign(count, 1);
+}
+
+void CullingSet::Set(size_t index, const BoundingSphere& sphere)
+{
+	x[index] = sphere.center.x;
+	y[index] = sphere.center.y;
+	z[index] = sphere.center.z;
+	radius[index] = sphere.radius;
+}
+
+void CullingSet::CullFrustum(const FrustumPlanes& planes, CullingStats& stats)
+{
+	CullSpheresFrustum(planes, x.data(), y.data(), z.data(), radius.data(), Count(), visible.data());
+
+	unsigned visible_count = unsigned(std::count(visible.begin(), visible.end(), 1));
+	stats.tested += unsigned(Count());
+	stats.visible += visible_count;
+	stats.frustum_culled += unsigned(Count()) - visible_count;
+}
+
+void CullingSet::CullHorizon(const glm::vec3& eye, const BoundingSphere& planet, CullingStats& stats)
+{
+	unsigned culled = unsigned(CullSpheresHorizon(eye, planet, x.data(), y.data(), z.data(), radius.data(), Count(), visible.data()));
+	stats.visible -= culled;
+	stats.horizon_culled += culled;
+}
+
+CullingStats CullingSet::CullFrustumAndHorizon(const FrustumPlanes& planes, const glm::vec3& eye, const BoundingSphere& planet,
+	size_t begin, size_t end)
+{
+	CullingStats stats = CullingStats();
+	if (begin >= end)
+		return stats;
+	size_t count = end - begin;
+	CullSpheresFrustum(planes, x.data() + begin, y.data() + begin, z.data() + begin, radius.data() + begin, count, visible.data() + begin);
+
+	unsigned visible_count = unsigned(std::count(visible.begin() + begin, visible.begin() + end, 1));
+	unsigned culled = unsigned(CullSpheresHorizon(eye, planet, x.data() + begin, y.data() + begin, z.data() + begin, radius.data() + begin,
+		count, visible.data() + begin));
+	stats.tested = unsigned(count);
+	stats.visible = visible_count - culled;
+	stats.frustum_culled = unsigned(count) - visible_count;
+	stats.horizon_culled = culled;
+	return stats;
+}
+
+void CullingSet::CullOccluded(const OcclusionBuffer& buffer, CullingStats& stats)
+{
+	for (size_t i = 0; i < Count(); ++i)
+		if (visible[i] && buffer.IsOccluded({ glm::vec3(x[i], y[i], z[i]), radius[i] }))
+		{
+			visible[i] = 0;
+			stats.visible--;
+			stats.occlusion_culled++;
+		}
+}
+
+/* Culling Functions */
+
+FrustumPlanes ExtractFrustumPlanes(const glm::mat4& projection_view)
+{
+	// Gribb/Hartmann: each plane is the last row of the matrix plus or minus one of the others, glm stores columns.
+	// With the reversed-Z projection the "far" plane comes out as the near one and "near" accepts everything.
+	const auto row = [&](int i) { return glm::vec4(projection_view[0][i], projection_view[1][i], projection_view[2][i], projection_view[3][i]); };
+
+	const glm::vec4 rows[6] = {
+		row(3) + row(0), row(3) - row(0),
+		row(3) + row(1), row(3) - row(1),
+		row(3) + row(2), row(3) - row(2)
+	};
+
+	FrustumPlanes planes;
+	for (int i = 0; i < 6; ++i)
+	{
+		// A far plane lost to float precision (near 1e-6, far 1e5) has no normal, it accepts everything
+		float length = glm::length(glm::vec3(rows[i]));
+		if (length == 0.f)
+		{
+			planes.x[i] = planes.y[i] = planes.z[i] = 0.f;
+			planes.w[i] = 1.f;
+			continue;
+		}
+		planes.x[i] = rows[i].x / length;
+		planes.y[i] = rows[i].y / length;
+		planes.z[i] = rows[i].z / length;
+		planes.w[i] = rows[i].w / length;
+	}
+	return planes;
+}
+
+BoundingSphere ComputeBoundingSphere(const std::vector<glm::vec3>& positions)
+{
+	// Centered on the bounding box, loose but cheap and stable
+	glm::vec3 min(INFINITY), max(-INFINITY);
+	for (const auto& p : positions)
+	{
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	BoundingSphere sphere = { (min + max) * 0.5f, 0.f };
+	for (const auto& p : positions)
+		sphere.radius = std::max(sphere.radius, glm::length(p - sphere.center));
+	return sphere;
+}
+
+BoundingSphere TransformBoundingSphere(const BoundingSphere& sphere, const glm::mat4& transform)
+{
+	// Non-uniform scale grows the sphere by the largest axis
+	float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+	return { glm::vec3(transform * glm::vec4(sphere.center, 1.f)), sphere.radius * scale };
+}
+
+void CullSpheresFrustum(const FrustumPlanes& planes, const float * x, const float * y, const float * z, const float * radius,
+	size_t count, uint8_t * visible)
+{
+	size_t i = 0;
+
+#if defined(__AVX__)
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(x + i), cy = _mm256_loadu_ps(y + i), cz = _mm256_loadu_ps(z + i);
+		__m256 negative_radius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radius + i));
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p)
+		{
+			__m256 distance = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(planes.x[p])), _mm256_mul_ps(cy, _mm256_set1_ps(planes.y[p]))),
+				_mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(planes.z[p])), _mm256_set1_ps(planes.w[p])));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negative_radius, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int k = 0; k < 8; ++k)
+			visible[i + k] = (mask >> k) & 1;
+	}
+#endif
+
+#if defined(CULLING_SSE)
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(x + i), cy = _mm_loadu_ps(y + i), cz = _mm_loadu_ps(z + i);
+		__m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p)
+		{
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(planes.x[p])), _mm_mul_ps(cy, _mm_set1_ps(planes.y[p]))),
+				_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(planes.z[p])), _mm_set1_ps(planes.w[p])));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negative_radius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4; ++k)
+			visible[i + k] = (mask >> k) & 1;
+	}
+#endif
+
+	// Remainder, and everything on targets without SSE
+	for (; i < count; ++i)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6; ++p)
+			inside = inside && x[i] * planes.x[p] + y[i] * planes.y[p] + z[i] * planes.z[p] + planes.w[p] >= -radius[i];
+		visible[i] = inside;
+	}
+}
+
+size_t CullSpheresHorizon(const glm::vec3& eye, const BoundingSphere& planet, const float * x, const float * y, const float * z, const float * radius,
+	size_t count, uint8_t * visible)
+{
+	// From inside the planet there is no horizon
+	glm::vec3 axis = planet.center - eye;
+	float distance = glm::length(axis);
+	if (distance <= planet.radius)
+		return 0;
+	axis /= distance;
+
+	// The planet's silhouette is a cone from the eye. Whatever lies completely inside that cone
+	// and beyond the plane of the horizon circle is behind the planet.
+	float sin_cone = planet.radius / distance;
+	float cos_cone = std::sqrt(1.f - sin_cone * sin_cone);
+	float horizon_plane = distance * cos_cone * cos_cone;
+
+	size_t culled = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!visible[i])
+			continue;
+
+		glm::vec3 to_sphere = glm::vec3(x[i], y[i], z[i]) - eye;
+		float along = glm::dot(to_sphere, axis);
+		float across = glm::length(to_sphere - along * axis);
+
+		bool beyond_horizon = along - radius[i] >= horizon_plane;
+		bool inside_cone = along * sin_cone - across * cos_cone >= radius[i];
+		if (beyond_horizon && inside_cone)
+		{
+			visible[i] = 0;
+			culled++;
+		}
+	}
+	return culled;
+}
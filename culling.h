@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+/* Culling Structs */
+
+struct BoundingSphere
+{
+	glm::vec3 center;
+	float radius;
+};
+
+// Normalized planes facing into the frustum, one array per component: left, right, bottom, top, near, far
+struct FrustumPlanes
+{
+	float x[6];
+	float y[6];
+	float z[6];
+	float w[6];
+};
+
+struct CullingStats
+{
+	unsigned tested;
+	unsigned visible;
+	unsigned frustum_culled;
+	unsigned horizon_culled;
+	unsigned occlusion_culled;
+};
+
+struct OcclusionBuffer;
+
+// World-space bounding spheres in structure-of-arrays layout, so one SIMD instruction
+// covers 4 (SSE) or 8 (AVX) of them. Index i of "visible" belongs to the i-th Add of the frame.
+struct CullingSet
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> radius;
+	std::vector<uint8_t> visible;
+
+	void Clear();
+	size_t Add(const BoundingSphere& sphere);
+
+	// For filling the set from several threads: Resize once, then Set every index
+	void Resize(size_t count);
+	void Set(size_t index, const BoundingSphere& sphere);
+
+	void CullFrustum(const FrustumPlanes& planes, CullingStats& stats);
+
+	// Run after CullFrustum, only spheres still visible are tested
+	void CullHorizon(const glm::vec3& eye, const BoundingSphere& planet, CullingStats& stats);
+	void CullOccluded(const OcclusionBuffer& buffer, CullingStats& stats);
+
+	// CullFrustum and CullHorizon of the spheres in [begin, end) only, so bands of the set can be culled in
+	// parallel. Returns the band's stats, to be summed up by the caller.
+	CullingStats CullFrustumAndHorizon(const FrustumPlanes& planes, const glm::vec3& eye, const BoundingSphere& planet,
+		size_t begin, size_t end);
+
+	size_t Count() const { return x.size(); }
+	bool IsVisible(size_t index) const { return visible[index] != 0; }
+};
+
+/* Culling Functions */
+
+FrustumPlanes ExtractFrustumPlanes(const glm::mat4& projection_view);
+
+BoundingSphere ComputeBoundingSphere(const std::vector<glm::vec3>& positions);
+BoundingSphere TransformBoundingSphere(const BoundingSphere& sphere, const glm::mat4& transform);
+
+// Writes 1 to "visible" for spheres intersecting all planes, 0 otherwise
+void CullSpheresFrustum(const FrustumPlanes& planes, const float * x, const float * y, const float * z, const float * radius,
+	size_t count, uint8_t * visible);
+
+// Clears "visible" for spheres hidden behind the planet as seen from "eye", returns how many were cleared
+size_t CullSpheresHorizon(const glm::vec3& eye, const BoundingSphere& planet, const float * x, const float * y, const float * z, const float * radius,
+	size_t count, uint8_t * visible);
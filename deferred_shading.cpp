@@ -0,0 +1,104 @@
+#include "deferred_shading.h"
+
+#include <iostream>
+
+#include "glm/gtc/type_ptr.hpp"
+
+/* Deferred Shading */
+
+DeferredShading::DeferredShading()
+	: framebuffer(0), albedo_texture(0), normal_texture(0), depth_texture(0), width(0), height(0), saved_framebuffer(0),
+	inverse_projection_view_location(-1), gbuffer_size_location(-1), depth_to_ndc_location(-1)
+{
+	glGenVertexArrays(1, &empty_vertex_array);
+}
+
+void DeferredShading::SetupLightingProgram(GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "u_gbuffer_albedo"), albedo_unit);
+	glUniform1i(glGetUniformLocation(program, "u_gbuffer_normal"), normal_unit);
+	glUniform1i(glGetUniformLocation(program, "u_gbuffer_depth"), depth_unit);
+
+	inverse_projection_view_location = glGetUniformLocation(program, "u_inverse_projection_view");
+	gbuffer_size_location = glGetUniformLocation(program, "u_gbuffer_size");
+	depth_to_ndc_location = glGetUniformLocation(program, "u_depth_to_ndc");
+}
+
+void DeferredShading::BeginGeometry(int width, int height)
+{
+	if (framebuffer == 0)
+	{
+		glGenFramebuffers(1, &framebuffer);
+		glGenTextures(1, &albedo_texture);
+		glGenTextures(1, &normal_texture);
+		glGenTextures(1, &depth_texture);
+	}
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &saved_framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	if (width != this->width || height != this->height)
+	{
+		this->width = width;
+		this->height = height;
+
+		// Each on its own unit, unit 0 holds the scene's texture
+		const auto allocate = [width, height](int unit, GLuint texture, GLint internal_format, GLenum format, GLenum type)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		};
+		allocate(albedo_unit, albedo_texture, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+		allocate(normal_unit, normal_texture, GL_RG16, GL_RG, GL_UNSIGNED_SHORT);
+		allocate(depth_unit, depth_texture, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+		glActiveTexture(GL_TEXTURE0);
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedo_texture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normal_texture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0);
+
+		const GLenum draw_buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, draw_buffers);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "Error: G-buffer framebuffer is incomplete" << std::endl;
+	}
+
+	// Material id 0 in albedo's alpha marks pixels nothing was drawn to
+	glViewport(0, 0, width, height);
+	const GLfloat zero[4] = { 0, 0, 0, 0 };
+	glClearBufferfv(GL_COLOR, 0, zero);
+	glClearBufferfv(GL_COLOR, 1, zero);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void DeferredShading::EndGeometry()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, saved_framebuffer);
+}
+
+void DeferredShading::Light(const glm::mat4& projection_view, bool zero_to_one_depth)
+{
+	glActiveTexture(GL_TEXTURE0 + albedo_unit);
+	glBindTexture(GL_TEXTURE_2D, albedo_texture);
+	glActiveTexture(GL_TEXTURE0 + normal_unit);
+	glBindTexture(GL_TEXTURE_2D, normal_texture);
+	glActiveTexture(GL_TEXTURE0 + depth_unit);
+	glBindTexture(GL_TEXTURE_2D, depth_texture);
+	glActiveTexture(GL_TEXTURE0);
+
+	glUniformMatrix4fv(inverse_projection_view_location, 1, GL_FALSE, glm::value_ptr(glm::inverse(projection_view)));
+	glUniform2f(gbuffer_size_location, float(width), float(height));
+	glUniform2f(depth_to_ndc_location, zero_to_one_depth ? 1.f : 2.f, zero_to_one_depth ? 0.f : -1.f);
+
+	GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+	glBindVertexArray(empty_vertex_array);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	if (depth_test)
+		glEnable(GL_DEPTH_TEST);
+}
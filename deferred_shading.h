@@ -0,0 +1,49 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include "glad/glad.h"
+
+/* Deferred Shading Structs */
+
+// Compact G-buffer: RGBA8 albedo + material id, RG16 octahedral normal and a 32-bit float
+// depth texture the lighting pass rebuilds positions from. 10 bytes per pixel, 12 with depth.
+struct DeferredShading
+{
+	static const int albedo_unit = 7;
+	static const int normal_unit = 8;
+	static const int depth_unit = 9;
+
+	GLuint framebuffer;
+	GLuint albedo_texture;
+	GLuint normal_texture;
+	GLuint depth_texture;
+	int width;
+	int height;
+
+	// Whatever was bound before the geometry pass, the lighting pass draws back into it
+	GLint saved_framebuffer;
+
+	// The lighting pass draws one triangle from gl_VertexID, core profile still wants a VAO
+	GLuint empty_vertex_array;
+
+	GLint inverse_projection_view_location;
+	GLint gbuffer_size_location;
+	GLint depth_to_ndc_location;
+
+	DeferredShading();
+
+	DeferredShading(const DeferredShading&) = delete;
+	DeferredShading& operator=(const DeferredShading&) = delete;
+
+	// Binds the G-buffer samplers and looks up the per-frame uniforms of the lighting program
+	void SetupLightingProgram(GLuint program);
+
+	// Binds, resizes if needed and clears the G-buffer. Depth test, clip control and glClearDepth
+	// are left as the caller set them, so the G-buffer depth follows the scene's depth mode.
+	void BeginGeometry(int width, int height);
+	void EndGeometry();
+
+	// Shades every covered pixel once into whatever framebuffer is bound. "zero_to_one_depth"
+	// tells how the depth buffer was written (glClipControl), the program must be in use.
+	void Light(const glm::mat4& projection_view, bool zero_to_one_depth);
+};
@@ -0,0 +1,30 @@
+#include "fixed_timestep.h"
+
+#include <algorithm>
+
+/* Fixed Timestep */
+
+FixedTimestep::FixedTimestep(double steps_per_second, int max_steps)
+	: step_seconds(1.0 / steps_per_second), accumulator(0.0), max_steps(max_steps)
+{
+}
+
+int FixedTimestep::Advance(double frame_seconds)
+{
+	accumulator += std::max(frame_seconds, 0.0);
+
+	int steps = 0;
+	while (accumulator >= step_seconds && steps < max_steps)
+	{
+		accumulator -= step_seconds;
+		steps++;
+	}
+	if (steps == max_steps)
+		accumulator = std::min(accumulator, step_seconds);
+	return steps;
+}
+
+float FixedTimestep::Alpha() const
+{
+	return float(std::min(accumulator / step_seconds, 1.0));
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+/* Fixed Timestep */
+
+// Accumulates rendered frame times and hands them out as whole simulation steps of step_seconds, so the
+// game advances the same way at 30 and at 1000 frames per second. What is left over is the fraction of a
+// step the rendered frame lies past the last simulated state, for interpolating between the last two.
+struct FixedTimestep
+{
+	double step_seconds;
+	double accumulator;
+	int max_steps; // per frame, after a long hitch the rest of the time is dropped instead of caught up on
+
+	FixedTimestep(double steps_per_second = 120.0, int max_steps = 8);
+
+	// Adds the frame's time and returns how many steps to simulate
+	int Advance(double frame_seconds);
+
+	// 0 at the previous simulated state, 1 at the latest
+	float Alpha() const;
+};
@@ -0,0 +1,230 @@
+#include "flow_field.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "glm/gtc/constants.hpp"
+
+// Cube face of a direction and its coordinates on that face, u and v in [-1, 1] after the equal-angle warp.
+// Face 2k + s looks down axis k, negated for s = 1; u runs along axis k + 1 and v along axis k + 2.
+static int CubeFace(const glm::vec3& direction, float& u, float& v)
+{
+	glm::vec3 magnitude = glm::abs(direction);
+	int axis = magnitude.x >= magnitude.y && magnitude.x >= magnitude.z ? 0 : (magnitude.y >= magnitude.z ? 1 : 2);
+	float major = std::max(magnitude[axis], 1e-30f);
+	u = std::atan(direction[(axis + 1) % 3] / major) * (4.f / glm::pi<float>());
+	v = std::atan(direction[(axis + 2) % 3] / major) * (4.f / glm::pi<float>());
+	return axis * 2 + (direction[axis] < 0.f ? 1 : 0);
+}
+
+// Point on the unit sphere at face coordinates u, v, which may run past the face edge onto its neighbours
+static glm::vec3 CubePoint(int face, float u, float v)
+{
+	int axis = face / 2;
+	glm::vec3 point(0.f);
+	point[axis] = face % 2 ? -1.f : 1.f;
+	point[(axis + 1) % 3] = std::tan(u * glm::pi<float>() / 4.f);
+	point[(axis + 2) % 3] = std::tan(v * glm::pi<float>() / 4.f);
+	return glm::normalize(point);
+}
+
+/* Flow Field */
+
+FlowField::FlowField(int face_cells, const glm::vec3& center, float radius, size_t cell_budget)
+	: face_cells(std::max(face_cells, 0)), center(center), radius(radius), cell_budget(cell_budget),
+	target_cell(0), ready(false), phase(MARCH_IDLE), march_target(0), march_cursor(0)
+{
+	size_t count = size_t(6) * this->face_cells * this->face_cells;
+	cell_x.resize(count);
+	cell_y.resize(count);
+	cell_z.resize(count);
+	neighbours.resize(count * 4);
+	cost.assign(count, 1.f);
+
+	const float step = 2.f / float(this->face_cells);
+	for (int face = 0; face < 6; ++face)
+		for (int row = 0; row < this->face_cells; ++row)
+			for (int column = 0; column < this->face_cells; ++column)
+			{
+				size_t cell = (size_t(face) * this->face_cells + row) * this->face_cells + column;
+				float u = (column + 0.5f) * step - 1.f, v = (row + 0.5f) * step - 1.f;
+				glm::vec3 point = CubePoint(face, u, v);
+				cell_x[cell] = point.x;
+				cell_y[cell] = point.y;
+				cell_z[cell] = point.z;
+
+				// Stepping past the edge of the face lands on the neighbouring face, whichever way it is turned
+				const glm::vec2 offsets[4] = { { -step, 0.f }, { step, 0.f }, { 0.f, -step }, { 0.f, step } };
+				for (int n = 0; n < 4; ++n)
+				{
+					float nu, nv;
+					int neighbour_face = CubeFace(CubePoint(face, u + offsets[n].x, v + offsets[n].y), nu, nv);
+					neighbours[cell * 4 + n] = FaceCell(neighbour_face, nu, nv);
+				}
+			}
+}
+
+uint32_t FlowField::FaceCell(int face, float u, float v) const
+{
+	int column = std::min(std::max(int((u + 1.f) * 0.5f * face_cells), 0), face_cells - 1);
+	int row = std::min(std::max(int((v + 1.f) * 0.5f * face_cells), 0), face_cells - 1);
+	return uint32_t((face * face_cells + row) * face_cells + column);
+}
+
+uint32_t FlowField::Cell(const glm::vec3& position) const
+{
+	float u, v;
+	int face = CubeFace(position - center, u, v);
+	return FaceCell(face, u, v);
+}
+
+float FlowField::CellSize() const
+{
+	// A quarter of a great circle per face edge
+	return face_cells > 0 ? radius * glm::half_pi<float>() / face_cells : 0.f;
+}
+
+void FlowField::SetCost(uint32_t cell, float cell_cost)
+{
+	// Takes effect with the next march
+	cost[cell] = cell_cost;
+}
+
+void FlowField::Update(const glm::vec3& target)
+{
+	if (CellCount() == 0)
+		return;
+
+	// A march toward a target that has moved on is finished anyway, its field is still better than none
+	if (phase == MARCH_IDLE)
+	{
+		uint32_t cell = Cell(target);
+		if (ready && cell == target_cell)
+			return;
+
+		march_target = cell;
+		march_distance.assign(CellCount(), flow_field_unreached);
+		settled.assign(CellCount(), 0);
+		front = decltype(front)();
+		march_distance[cell] = 0.f;
+		front.push({ 0.f, cell });
+		phase = MARCH_DISTANCE;
+	}
+
+	size_t budget = cell_budget;
+	if (phase == MARCH_DISTANCE && MarchDistances(budget))
+	{
+		march_direction_x.resize(CellCount());
+		march_direction_y.resize(CellCount());
+		march_direction_z.resize(CellCount());
+		march_cursor = 0;
+		phase = MARCH_DIRECTION;
+	}
+	if (phase == MARCH_DIRECTION && MarchDirections(budget))
+	{
+		distance.swap(march_distance);
+		direction_x.swap(march_direction_x);
+		direction_y.swap(march_direction_y);
+		direction_z.swap(march_direction_z);
+		target_cell = march_target;
+		ready = true;
+		phase = MARCH_IDLE;
+	}
+}
+
+float FlowField::SolveEikonal(uint32_t cell) const
+{
+	// Smallest settled distance along each grid direction, and how far away that neighbour is
+	glm::vec3 position = CellCenter(cell);
+	float known[2], spacing[2];
+	for (int axis = 0; axis < 2; ++axis)
+	{
+		known[axis] = flow_field_unreached;
+		spacing[axis] = 1.f;
+		for (int side = 0; side < 2; ++side)
+		{
+			uint32_t neighbour = neighbours[cell * 4 + axis * 2 + side];
+			if (settled[neighbour] && march_distance[neighbour] < known[axis])
+			{
+				known[axis] = march_distance[neighbour];
+				spacing[axis] = radius * glm::length(CellCenter(neighbour) - position);
+			}
+		}
+	}
+
+	// |grad T| = cost, from both directions if both are known and close enough to agree, else from the nearer
+	float a = known[0], b = known[1];
+	float one_sided = std::min(a + spacing[0] * cost[cell], b + spacing[1] * cost[cell]);
+	if (a >= flow_field_unreached || b >= flow_field_unreached)
+		return one_sided;
+
+	float wa = 1.f / (spacing[0] * spacing[0]), wb = 1.f / (spacing[1] * spacing[1]);
+	float qa = wa + wb, qb = a * wa + b * wb, qc = a * a * wa + b * b * wb - cost[cell] * cost[cell];
+	float discriminant = qb * qb - qa * qc;
+	if (discriminant < 0.f)
+		return one_sided;
+	float both = (qb + std::sqrt(discriminant)) / qa;
+	return both >= std::max(a, b) ? std::min(both, one_sided) : one_sided;
+}
+
+bool FlowField::MarchDistances(size_t& budget)
+{
+	while (budget > 0 && !front.empty())
+	{
+		uint32_t cell = front.top().second;
+		front.pop();
+		if (settled[cell])
+			continue; // an older, longer entry of a cell that was improved since
+		settled[cell] = 1;
+		budget--;
+
+		for (int n = 0; n < 4; ++n)
+		{
+			uint32_t neighbour = neighbours[cell * 4 + n];
+			if (settled[neighbour] || cost[neighbour] >= flow_field_unreached)
+				continue;
+			float tentative = SolveEikonal(neighbour);
+			if (tentative < march_distance[neighbour])
+			{
+				march_distance[neighbour] = tentative;
+				front.push({ tentative, neighbour });
+			}
+		}
+	}
+	return front.empty();
+}
+
+bool FlowField::MarchDirections(size_t& budget)
+{
+	for (; budget > 0 && march_cursor < CellCount(); --budget, ++march_cursor)
+	{
+		uint32_t cell = uint32_t(march_cursor);
+		glm::vec3 position = CellCenter(cell);
+		glm::vec3 gradient(0.f);
+
+		// Central differences where both neighbours are reachable, one-sided next to a blocked cell
+		if (march_distance[cell] < flow_field_unreached)
+			for (int axis = 0; axis < 2; ++axis)
+			{
+				uint32_t low = neighbours[cell * 4 + axis * 2], high = neighbours[cell * 4 + axis * 2 + 1];
+				if (march_distance[low] >= flow_field_unreached)
+					low = cell;
+				if (march_distance[high] >= flow_field_unreached)
+					high = cell;
+				if (low == high)
+					continue;
+				glm::vec3 across = CellCenter(high) - CellCenter(low);
+				gradient += (march_distance[high] - march_distance[low]) / (radius * glm::dot(across, across)) * across;
+			}
+
+		// Downhill, along the surface
+		glm::vec3 direction = -gradient;
+		direction -= glm::dot(direction, position) * position;
+		float length = glm::length(direction);
+		direction = length > 1e-12f ? direction / length : glm::vec3(0.f);
+		march_direction_x[cell] = direction.x;
+		march_direction_y[cell] = direction.y;
+		march_direction_z[cell] = direction.z;
+	}
+	return march_cursor == CellCount();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+/* Flow Field Structs */
+
+// Marks cells whose distance is not known yet, and the distance of blocked cells
+const float flow_field_unreached = 1e30f;
+
+// Travel distance to one target over the surface of a planet, and the direction that shortens it fastest, on a
+// cube-sphere grid: the six faces of a cube with face_cells x face_cells cells each, pushed out onto the sphere
+// with an equal-angle warp so all cells have about the same size. Distances are solved with fast marching, which
+// follows the surface like a straight line would instead of in grid steps, and every cell has a cost, so craters
+// and rocks can later be made slow or impassable without touching the rovers.
+//
+// The march toward the current target is spread over the simulation steps, cell_budget cells at a time, into a
+// second set of arrays. The finished field stays in use until the next one is done, and a new march only starts
+// once the target has moved to another cell, so a rover crowd of any size costs one sample per rover and step.
+struct FlowField
+{
+	int face_cells;
+	glm::vec3 center;
+	float radius;
+	size_t cell_budget; // cells settled per Update
+
+	// Per cell, index face * face_cells^2 + row * face_cells + column
+	std::vector<float> cell_x, cell_y, cell_z; // center, on the unit sphere
+	std::vector<uint32_t> neighbours; // 4 per cell: previous and next column, previous and next row
+	std::vector<float> cost; // distance multiplier, 1 on open ground, flow_field_unreached where blocked
+
+	// The finished field: distance to target_cell and the unit direction to drive in, tangent to the sphere
+	std::vector<float> distance;
+	std::vector<float> direction_x, direction_y, direction_z;
+	uint32_t target_cell;
+	bool ready;
+
+	// The march in progress
+	enum MarchPhase { MARCH_IDLE, MARCH_DISTANCE, MARCH_DIRECTION };
+	MarchPhase phase;
+	uint32_t march_target;
+	size_t march_cursor; // next cell of the direction phase
+	std::vector<float> march_distance;
+	std::vector<float> march_direction_x, march_direction_y, march_direction_z;
+	std::vector<uint8_t> settled;
+	std::priority_queue<std::pair<float, uint32_t>, std::vector<std::pair<float, uint32_t>>, std::greater<std::pair<float, uint32_t>>> front;
+
+	FlowField(int face_cells, const glm::vec3& center, float radius, size_t cell_budget = 16384);
+
+	size_t CellCount() const { return cost.size(); }
+	uint32_t Cell(const glm::vec3& position) const;
+	float CellSize() const; // average edge length on the surface
+	void SetCost(uint32_t cell, float cell_cost);
+
+	// Once per simulation step: continues the march, or starts one if the target left the field's cell
+	void Update(const glm::vec3& target);
+
+	// Moves "budget" cells of the march forward, true once the march is done and the field swapped in
+	bool MarchDistances(size_t& budget);
+	bool MarchDirections(size_t& budget);
+	float SolveEikonal(uint32_t cell) const;
+
+	glm::vec3 CellCenter(uint32_t cell) const { return glm::vec3(cell_x[cell], cell_y[cell], cell_z[cell]); }
+	uint32_t FaceCell(int face, float u, float v) const; // u, v in equal-angle face coordinates [-1, 1]
+};
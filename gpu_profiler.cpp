@@ -0,0 +1,234 @@
+#include "gpu_profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+/* GPU Profiler */
+
+GpuProfiler::GpuProfiler(size_t history_frames)
+	: frame(0), history_capacity(std::max<size_t>(history_frames, 1)), history_next(0), dropped_frames(0)
+{
+	for (auto& slot : slots)
+	{
+		slot.frame = 0;
+		slot.pending = false;
+		slot.used_queries = 0;
+	}
+}
+
+void GpuProfiler::BeginFrame()
+{
+	auto& slot = slots[frame % ring_size];
+	if (slot.pending)
+		Collect(slot);
+
+	slot.frame = frame;
+	slot.pending = false;
+	slot.used_queries = 0;
+	slot.intervals.clear();
+	open_intervals.clear();
+}
+
+void GpuProfiler::EndFrame()
+{
+	auto& slot = slots[frame % ring_size];
+
+	// Unbalanced scopes end with the frame rather than poisoning the next one
+	while (!open_intervals.empty())
+		EndScope();
+
+	slot.pending = !slot.intervals.empty();
+	frame++;
+}
+
+void GpuProfiler::BeginScope(const char * name)
+{
+	auto found = scope_ids.find(name);
+	int scope;
+	if (found != scope_ids.end())
+		scope = found->second;
+	else
+	{
+		scope = int(scope_names.size());
+		scope_ids.emplace(name, scope);
+		scope_names.push_back(name);
+		scope_depths.push_back(int(open_intervals.size()));
+	}
+
+	auto& slot = slots[frame % ring_size];
+	slot.intervals.push_back({ scope, Timestamp(slot), 0 });
+	open_intervals.push_back(slot.intervals.size() - 1);
+}
+
+void GpuProfiler::EndScope()
+{
+	if (open_intervals.empty())
+		return;
+
+	auto& slot = slots[frame % ring_size];
+	slot.intervals[open_intervals.back()].end_query = Timestamp(slot);
+	open_intervals.pop_back();
+}
+
+size_t GpuProfiler::Timestamp(FrameSlot& slot)
+{
+	if (slot.used_queries == slot.queries.size())
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		slot.queries.push_back(query);
+	}
+
+	glQueryCounter(slot.queries[slot.used_queries], GL_TIMESTAMP);
+	return slot.used_queries++;
+}
+
+void GpuProfiler::Collect(FrameSlot& slot)
+{
+	// Timestamps complete in order, so the last one being available means they all are
+	GLint available = 0;
+	glGetQueryObjectiv(slot.queries[slot.used_queries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+	{
+		dropped_frames++;
+		return;
+	}
+
+	std::vector<GLuint64> timestamps(slot.used_queries);
+	for (size_t i = 0; i < slot.used_queries; ++i)
+		glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+
+	FrameRecord record;
+	record.frame = slot.frame;
+	record.milliseconds.assign(scope_names.size(), -1.f);
+	for (const auto& interval : slot.intervals)
+	{
+		float& milliseconds = record.milliseconds[interval.scope];
+		milliseconds = std::max(milliseconds, 0.f) + float(timestamps[interval.end_query] - timestamps[interval.begin_query]) * 1e-6f;
+	}
+
+	if (history.size() < history_capacity)
+		history.push_back(std::move(record));
+	else
+		history[history_next] = std::move(record);
+	history_next = (history_next + 1) % history_capacity;
+}
+
+std::vector<const GpuProfiler::FrameRecord *> GpuProfiler::OrderedHistory() const
+{
+	std::vector<const FrameRecord *> ordered;
+	for (const auto& record : history)
+		ordered.push_back(&record);
+	std::sort(ordered.begin(), ordered.end(), [](const FrameRecord * a, const FrameRecord * b) { return a->frame < b->frame; });
+	return ordered;
+}
+
+std::vector<GpuScopeStats> GpuProfiler::Stats() const
+{
+	std::vector<GpuScopeStats> stats;
+	std::vector<float> samples;
+	for (size_t scope = 0; scope < scope_names.size(); ++scope)
+	{
+		samples.clear();
+		for (const auto& record : history)
+			if (scope < record.milliseconds.size() && record.milliseconds[scope] >= 0)
+				samples.push_back(record.milliseconds[scope]);
+
+		GpuScopeStats scope_stats = { scope_names[scope], scope_depths[scope], samples.size(), 0, 0, 0, 0, 0 };
+		if (!samples.empty())
+		{
+			std::sort(samples.begin(), samples.end());
+
+			// Nearest rank
+			const auto percentile = [&](float p) { return samples[std::min(samples.size() - 1, size_t(std::ceil(p * samples.size())) - 1)]; };
+
+			float sum = 0;
+			for (auto sample : samples)
+				sum += sample;
+			scope_stats.average_ms = sum / samples.size();
+			scope_stats.p50_ms = percentile(0.50f);
+			scope_stats.p95_ms = percentile(0.95f);
+			scope_stats.p99_ms = percentile(0.99f);
+			scope_stats.max_ms = samples.back();
+		}
+		stats.push_back(scope_stats);
+	}
+	return stats;
+}
+
+void GpuProfiler::Print(std::ostream& out) const
+{
+	out << "GPU scope                      avg ms   p50 ms   p95 ms   p99 ms   max ms  (" << history.size() << " frames, " << dropped_frames << " dropped)" << std::endl;
+	for (const auto& scope : Stats())
+	{
+		std::string name = std::string(2 * scope.depth, ' ') + scope.name;
+		out << "  " << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(9) << scope.average_ms << std::setw(9) << scope.p50_ms << std::setw(9) << scope.p95_ms
+			<< std::setw(9) << scope.p99_ms << std::setw(9) << scope.max_ms << std::endl;
+	}
+	out << std::defaultfloat;
+}
+
+bool GpuProfiler::WriteCsv(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		std::cout << "Error: Could not write GPU profile " << path << std::endl;
+		return false;
+	}
+
+	file << "frame";
+	for (const auto& name : scope_names)
+		file << "," << name;
+	file << "\n";
+
+	for (auto record : OrderedHistory())
+	{
+		file << record->frame;
+		for (size_t scope = 0; scope < scope_names.size(); ++scope)
+		{
+			file << ",";
+			if (scope < record->milliseconds.size() && record->milliseconds[scope] >= 0)
+				file << record->milliseconds[scope];
+		}
+		file << "\n";
+	}
+	return bool(file);
+}
+
+bool GpuProfiler::WriteJson(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		std::cout << "Error: Could not write GPU profile " << path << std::endl;
+		return false;
+	}
+
+	// Scope names are our own string literals, nothing in them needs escaping
+	auto ordered = OrderedHistory();
+	auto stats = Stats();
+	file << "{\n  \"dropped_frames\": " << dropped_frames << ",\n  \"scopes\": [";
+	for (size_t scope = 0; scope < stats.size(); ++scope)
+	{
+		const auto& s = stats[scope];
+		file << (scope ? ",\n" : "\n") << "    { \"name\": \"" << s.name << "\", \"depth\": " << s.depth << ", \"frames\": " << s.frames
+			<< ", \"average_ms\": " << s.average_ms << ", \"p50_ms\": " << s.p50_ms << ", \"p95_ms\": " << s.p95_ms
+			<< ", \"p99_ms\": " << s.p99_ms << ", \"max_ms\": " << s.max_ms << ", \"samples\": [";
+
+		bool first = true;
+		for (auto record : ordered)
+			if (scope < record->milliseconds.size() && record->milliseconds[scope] >= 0)
+			{
+				file << (first ? "" : ", ") << "[" << record->frame << ", " << record->milliseconds[scope] << "]";
+				first = false;
+			}
+		file << "] }";
+	}
+	file << "\n  ]\n}\n";
+	return bool(file);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "glad/glad.h"
+
+/* GPU Profiler Structs */
+
+struct GpuScopeStats
+{
+	std::string name;
+	int depth; // nesting level, for indenting reports
+	size_t frames; // history frames the scope appeared in
+	float average_ms;
+	float p50_ms;
+	float p95_ms;
+	float p99_ms;
+	float max_ms;
+};
+
+// Named GPU scopes timed with GL_TIMESTAMP queries. Every frame uses its own set of query objects from a
+// small ring and results are read back ring_size frames later, so reading never stalls the pipeline; a
+// frame whose queries are still not done by then is dropped instead of waited for. Scopes may nest, and
+// a scope opened several times in one frame adds up.
+struct GpuProfiler
+{
+	static const int ring_size = 4;
+
+	struct Interval
+	{
+		int scope;
+		size_t begin_query;
+		size_t end_query;
+	};
+
+	struct FrameSlot
+	{
+		uint64_t frame;
+		bool pending;
+		std::vector<GLuint> queries; // only grows, reused every time the ring comes around
+		size_t used_queries;
+		std::vector<Interval> intervals;
+	};
+
+	// Milliseconds per scope for one frame, negative where the scope was not used
+	struct FrameRecord
+	{
+		uint64_t frame;
+		std::vector<float> milliseconds;
+	};
+
+	std::vector<std::string> scope_names;
+	std::vector<int> scope_depths;
+	std::unordered_map<std::string, int> scope_ids;
+
+	FrameSlot slots[ring_size];
+	std::vector<size_t> open_intervals;
+	uint64_t frame;
+
+	// Rolling window the statistics are taken over
+	std::vector<FrameRecord> history;
+	size_t history_capacity;
+	size_t history_next;
+	uint64_t dropped_frames;
+
+	GpuProfiler(size_t history_frames = 300);
+
+	// No GL calls in the destructor, the context is gone by the time main's locals are destroyed
+	GpuProfiler(const GpuProfiler&) = delete;
+	GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+	// Collects the results of the frame that last used this ring slot
+	void BeginFrame();
+	void EndFrame();
+
+	void BeginScope(const char * name);
+	void EndScope();
+
+	// Over the frames in the history window, in order of first use
+	std::vector<GpuScopeStats> Stats() const;
+	void Print(std::ostream& out) const;
+
+	// One row per frame and one column per scope
+	bool WriteCsv(const std::string& path) const;
+	// Statistics per scope together with their per-frame samples
+	bool WriteJson(const std::string& path) const;
+
+	size_t Timestamp(FrameSlot& slot);
+	void Collect(FrameSlot& slot);
+	std::vector<const FrameRecord *> OrderedHistory() const;
+};
@@ -0,0 +1,157 @@
+#include "headless_context.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#if defined(__linux__)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define HEADLESS_EGL 1
+#endif
+
+/* Headless Context */
+
+HeadlessContext::HeadlessContext()
+	: display(NULL), context(NULL), surface(NULL)
+{
+}
+
+#if defined(HEADLESS_EGL)
+
+bool HeadlessContext::Create(int width, int height)
+{
+	// The surfaceless platform needs no X11 or Wayland server, older EGLs only have the default display
+	EGLDisplay egl_display = EGL_NO_DISPLAY;
+	const char * client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (client_extensions != NULL && std::strstr(client_extensions, "EGL_MESA_platform_surfaceless") != NULL && get_platform_display != NULL)
+		egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (egl_display == EGL_NO_DISPLAY)
+		egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &major, &minor))
+	{
+		std::cout << "Error: No EGL display for the headless context" << std::endl;
+		return false;
+	}
+	display = egl_display;
+
+	const EGLint config_attributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint config_count = 0;
+	if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(egl_display, config_attributes, &config, 1, &config_count) || config_count == 0)
+	{
+		std::cout << "Error: No EGL config with desktop OpenGL and pbuffers" << std::endl;
+		Destroy();
+		return false;
+	}
+
+	const EGLint surface_attributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+	surface = eglCreatePbufferSurface(egl_display, config, surface_attributes);
+
+	const EGLint context_attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attributes);
+	if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT || !eglMakeCurrent(egl_display, surface, surface, context))
+	{
+		std::cout << "Error: Could not create a headless OpenGL 3.3 context (EGL error 0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+		Destroy();
+		return false;
+	}
+
+	std::cout << "Headless EGL " << major << "." << minor << " context, " << width << "x" << height << " pbuffer" << std::endl;
+	return true;
+}
+
+void HeadlessContext::Destroy()
+{
+	if (display == NULL)
+		return;
+
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (context != NULL && context != EGL_NO_CONTEXT)
+		eglDestroyContext(display, context);
+	if (surface != NULL && surface != EGL_NO_SURFACE)
+		eglDestroySurface(display, surface);
+	eglTerminate(display);
+
+	display = NULL;
+	context = NULL;
+	surface = NULL;
+}
+
+void * HeadlessContext::GetProcAddress(const char * name)
+{
+	return (void *)eglGetProcAddress(name);
+}
+
+#else
+
+bool HeadlessContext::Create(int width, int height)
+{
+	return false;
+}
+
+void HeadlessContext::Destroy()
+{
+}
+
+void * HeadlessContext::GetProcAddress(const char * name)
+{
+	return NULL;
+}
+
+#endif
+
+/* Frame Time Stats */
+
+FrameTimeStats::FrameTimeStats(const char * name, size_t warmup_frames)
+	: name(name), warmup_frames(warmup_frames)
+{
+}
+
+void FrameTimeStats::Add(double seconds)
+{
+	frame_seconds.push_back(seconds);
+}
+
+void FrameTimeStats::Print(std::ostream& out) const
+{
+	if (frame_seconds.size() <= warmup_frames)
+	{
+		out << name << ": not enough frames for statistics (" << frame_seconds.size() << ", " << warmup_frames << " warm-up)" << std::endl;
+		return;
+	}
+
+	std::vector<double> sorted(frame_seconds.begin() + warmup_frames, frame_seconds.end());
+	std::sort(sorted.begin(), sorted.end());
+
+	double sum = 0;
+	for (auto seconds : sorted)
+		sum += seconds;
+	double average = sum / sorted.size();
+
+	// Nearest rank
+	const auto percentile = [&](double p) { return sorted[std::min(sorted.size() - 1, size_t(std::ceil(p * sorted.size())) - 1)]; };
+
+	out << std::fixed << std::setprecision(3)
+		<< name << " over " << sorted.size() << " frames (" << warmup_frames << " warm-up frames skipped): "
+		<< "avg " << average * 1e3 << " ms, min " << sorted.front() * 1e3 << " ms, p50 " << percentile(0.50) * 1e3
+		<< " ms, p95 " << percentile(0.95) * 1e3 << " ms, p99 " << percentile(0.99) * 1e3 << " ms, max " << sorted.back() * 1e3
+		<< " ms, " << std::setprecision(1) << 1.0 / average << " fps" << std::endl;
+	out << std::defaultfloat;
+}
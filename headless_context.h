@@ -0,0 +1,42 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+
+/* Headless Context Structs */
+
+// OpenGL 3.3 core context without a window, for benchmarks on machines with no display. On Linux this is
+// EGL on a pbuffer the size of the render target, which also works with Mesa's llvmpipe and no GPU.
+// Platforms without EGL report failure and the caller falls back to a hidden GLFW window.
+struct HeadlessContext
+{
+	void * display;
+	void * context;
+	void * surface;
+
+	HeadlessContext();
+
+	// No EGL calls in the destructor, Destroy() is called next to glfwTerminate
+	HeadlessContext(const HeadlessContext&) = delete;
+	HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+	// Creates the context and makes it current, the pbuffer stands in for the window's framebuffer
+	bool Create(int width, int height);
+	void Destroy();
+
+	// For gladLoadGLLoader
+	static void * GetProcAddress(const char * name);
+};
+
+// Wall-clock frame times of a benchmark run, the first warmup_frames are left out of the statistics
+struct FrameTimeStats
+{
+	const char * name; // what is timed, starts the printed line
+	std::vector<double> frame_seconds;
+	size_t warmup_frames;
+
+	FrameTimeStats(const char * name = "Frame time", size_t warmup_frames = 10);
+
+	void Add(double seconds);
+	void Print(std::ostream& out) const;
+};
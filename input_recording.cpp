@@ -0,0 +1,161 @@
+#include "input_recording.h"
+
+#include <fstream>
+#include <iostream>
+
+/* Input Recording */
+
+InputRecording::InputRecording()
+	: recording_frame{ 0.f, 0, 0 }, replay_frame(0), replay_event(0)
+{
+}
+
+int InputRecording::KeyBit(int key) const
+{
+	for (size_t i = 0; i < keys.size(); ++i)
+		if (keys[i] == key)
+			return int(i);
+	return -1;
+}
+
+void InputRecording::RecordKey(int key, bool down)
+{
+	// Keys get their bit the first time the game polls them
+	int bit = KeyBit(key);
+	if (bit < 0)
+	{
+		if (keys.size() == input_recording_max_keys)
+			return;
+		bit = int(keys.size());
+		keys.push_back(key);
+	}
+	if (down)
+		recording_frame.keys_down |= 1u << bit;
+}
+
+void InputRecording::RecordEvent(const InputEvent& event)
+{
+	events.push_back(event);
+	recording_frame.event_count++;
+}
+
+void InputRecording::EndRecordedFrame(float delta_seconds)
+{
+	recording_frame.delta_seconds = delta_seconds;
+	frames.push_back(recording_frame);
+	recording_frame = { 0.f, 0, 0 };
+}
+
+bool InputRecording::Write(const std::string& path) const
+{
+	InputRecordingHeader header = {};
+	header.magic = input_recording_magic;
+	header.version = input_recording_version;
+	header.frame_count = uint32_t(frames.size());
+	header.event_count = 0;
+	for (const auto& frame : frames)
+		header.event_count += frame.event_count;
+	header.key_count = uint32_t(keys.size());
+	for (size_t i = 0; i < keys.size(); ++i)
+		header.keys[i] = keys[i];
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "Error: Could not open " << path << " for writing" << std::endl;
+		return false;
+	}
+
+	// Events after the last finished frame never reached the game and are left out
+	file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char *>(frames.data()), sizeof(InputFrameRecord) * frames.size());
+	file.write(reinterpret_cast<const char *>(events.data()), sizeof(InputEvent) * header.event_count);
+	return bool(file);
+}
+
+bool InputRecording::Read(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		std::cout << "Error: Could not open " << path << std::endl;
+		return false;
+	}
+	uint64_t file_size = uint64_t(file.tellg());
+	file.seekg(0);
+
+	InputRecordingHeader header;
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+		header.magic != input_recording_magic || header.version != input_recording_version || header.key_count > input_recording_max_keys)
+	{
+		std::cout << "Error: " << path << " is not an input recording" << std::endl;
+		return false;
+	}
+
+	// Checked against the file before anything is allocated, a corrupt count must not ask for gigabytes
+	uint64_t expected_size = sizeof(header) + uint64_t(header.frame_count) * sizeof(InputFrameRecord) +
+		uint64_t(header.event_count) * sizeof(InputEvent);
+	if (expected_size > file_size)
+	{
+		std::cout << "Error: " << path << " is truncated" << std::endl;
+		return false;
+	}
+
+	keys.assign(header.keys, header.keys + header.key_count);
+	frames.resize(header.frame_count);
+	events.resize(header.event_count);
+	if (!file.read(reinterpret_cast<char *>(frames.data()), sizeof(InputFrameRecord) * frames.size()) ||
+		!file.read(reinterpret_cast<char *>(events.data()), sizeof(InputEvent) * events.size()))
+	{
+		std::cout << "Error: " << path << " is truncated" << std::endl;
+		return false;
+	}
+
+	// Frames must not claim more events than there are
+	size_t event_total = 0;
+	for (const auto& frame : frames)
+		event_total += frame.event_count;
+	if (event_total != events.size())
+	{
+		std::cout << "Error: " << path << " has inconsistent event counts" << std::endl;
+		return false;
+	}
+
+	replay_frame = 0;
+	replay_event = 0;
+	return true;
+}
+
+bool InputRecording::ReplayFinished() const
+{
+	return replay_frame >= frames.size();
+}
+
+bool InputRecording::ReplayKeyDown(int key) const
+{
+	int bit = KeyBit(key);
+	return bit >= 0 && !ReplayFinished() && (frames[replay_frame].keys_down & (1u << bit)) != 0;
+}
+
+float InputRecording::ReplayDelta() const
+{
+	return ReplayFinished() ? 0.f : frames[replay_frame].delta_seconds;
+}
+
+const InputEvent * InputRecording::ReplayEventsBegin() const
+{
+	return events.data() + replay_event;
+}
+
+const InputEvent * InputRecording::ReplayEventsEnd() const
+{
+	return ReplayEventsBegin() + (ReplayFinished() ? 0 : frames[replay_frame].event_count);
+}
+
+void InputRecording::NextReplayFrame()
+{
+	if (ReplayFinished())
+		return;
+	replay_event += frames[replay_frame].event_count;
+	replay_frame++;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Input Recording Format */
+
+// ".minput" files hold one play session: an InputRecordingHeader, then frame_count InputFrameRecords,
+// then event_count InputEvents in the order they arrived. Frames take their events from that list in turn.
+const uint32_t input_recording_magic = 0x4E49524D; // "MRIN"
+const uint32_t input_recording_version = 1;
+const size_t input_recording_max_keys = 16;
+
+struct InputRecordingHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t frame_count;
+	uint32_t event_count;
+	uint32_t key_count;
+	int32_t keys[input_recording_max_keys]; // key codes of the keys_down bits
+};
+
+struct InputFrameRecord
+{
+	float delta_seconds; // the frame's time step
+	uint32_t keys_down; // polled keys held during the frame, bit i is keys[i]
+	uint32_t event_count; // events delivered before the frame's input was handled
+};
+
+enum InputEventType : uint8_t
+{
+	INPUT_EVENT_KEY,
+	INPUT_EVENT_CURSOR,
+	INPUT_EVENT_SCROLL,
+};
+
+struct InputEvent
+{
+	double x, y; // cursor position or scroll offset
+	float time; // seconds since startup, informational
+	int16_t key;
+	uint8_t action;
+	uint8_t type;
+};
+
+/* Input Recording */
+
+enum InputMode
+{
+	INPUT_MODE_LIVE,
+	INPUT_MODE_RECORD, // live input, written to a file on exit
+	INPUT_MODE_REPLAY, // input and time steps come from a file instead of the window
+};
+
+// Everything the game loop reads from the window, per frame: the polled keys, the callback events and the
+// time step. Recorded sessions are replayed exactly, so two builds can be timed on the same play session.
+struct InputRecording
+{
+	std::vector<int> keys;
+	std::vector<InputFrameRecord> frames;
+	std::vector<InputEvent> events;
+
+	// Recording: the frame being filled in, its events are the ones recorded since the last EndFrame
+	InputFrameRecord recording_frame;
+
+	// Replay position
+	size_t replay_frame;
+	size_t replay_event;
+
+	InputRecording();
+
+	// Recording
+	void RecordKey(int key, bool down);
+	void RecordEvent(const InputEvent& event);
+	void EndRecordedFrame(float delta_seconds);
+	bool Write(const std::string& path) const;
+
+	// Replay. Events of the current frame are [ReplayEventsBegin(), ReplayEventsEnd()).
+	bool Read(const std::string& path);
+	bool ReplayFinished() const;
+	bool ReplayKeyDown(int key) const;
+	float ReplayDelta() const;
+	const InputEvent * ReplayEventsBegin() const;
+	const InputEvent * ReplayEventsEnd() const;
+	void NextReplayFrame();
+
+	// Index of the key's keys_down bit, -1 if it is not in keys
+	int KeyBit(int key) const;
+};
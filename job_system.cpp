@@ -0,0 +1,233 @@
+#include "job_system.h"
+
+#include <algorithm>
+
+#include "cpu_profiler.h"
+
+namespace
+{
+	// Which queue the calling thread owns. Threads that are not workers of the system share queue 0.
+	thread_local const JobSystem * current_system = NULL;
+	thread_local size_t current_thread_index = 0;
+
+	// Jobs running on this thread, and the time the outermost one spent waiting without anything to run.
+	// A job that waits for others is only busy while it or they run, not while it spins.
+	thread_local int job_depth = 0;
+	thread_local int64_t job_idle_ns = 0;
+}
+
+/* Job Graph */
+
+size_t JobGraph::Add(const char * name, JobFunction function)
+{
+	names.push_back(name);
+	functions.push_back(std::move(function));
+	dependents.emplace_back();
+	dependency_count.push_back(0);
+	remaining.reset(new std::atomic<int>[Count()]);
+	return Count() - 1;
+}
+
+void JobGraph::Depend(size_t job, size_t on)
+{
+	dependents[on].push_back(job);
+	dependency_count[job]++;
+}
+
+/* Job System */
+
+JobSystem::JobSystem(int worker_count)
+	: queued(0), stopping(false), utilization_busy_ns(0), utilization_start_ns(CpuProfiler::Now())
+{
+	size_t thread_count = size_t(std::max(worker_count, 0)) + 1;
+	for (size_t i = 0; i < thread_count; ++i)
+		queues.emplace_back(new JobQueue);
+	busy_ns.reset(new std::atomic<int64_t>[thread_count]);
+	for (size_t i = 0; i < thread_count; ++i)
+		busy_ns[i] = 0;
+
+	for (size_t i = 1; i < thread_count; ++i)
+		workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	work_available.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+size_t JobSystem::ThreadIndex() const
+{
+	return current_system == this ? current_thread_index : 0;
+}
+
+void JobSystem::Submit(const char * name, JobFunction function, JobCounter& counter)
+{
+	counter.pending.fetch_add(1, std::memory_order_relaxed);
+	Push({ name, std::move(function), &counter });
+}
+
+void JobSystem::Push(Job job)
+{
+	{
+		auto& queue = *queues[ThreadIndex()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(job));
+	}
+	queued.fetch_add(1, std::memory_order_release);
+
+	// Taking the lock orders this against a worker between checking "queued" and going to sleep
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+	}
+	work_available.notify_one();
+}
+
+bool JobSystem::TryPop(size_t thread_index, Job& job)
+{
+	for (size_t k = 0; k < queues.size(); ++k)
+	{
+		bool own = k == 0;
+		auto& queue = *queues[(thread_index + k) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+			continue;
+		if (own)
+		{
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		queued.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void JobSystem::Execute(size_t thread_index, Job& job)
+{
+	PROFILE_BEGIN(job.name);
+	int64_t start = CpuProfiler::Now();
+	int64_t idle_before = job_idle_ns;
+	job_depth++;
+	job.function();
+	job_depth--;
+
+	// Jobs run while this one waited are in its time already
+	if (job_depth == 0)
+	{
+		busy_ns[thread_index].fetch_add(CpuProfiler::Now() - start - (job_idle_ns - idle_before), std::memory_order_relaxed);
+		job_idle_ns = 0;
+	}
+	PROFILE_END();
+
+	job.counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void JobSystem::Wait(JobCounter& counter)
+{
+	size_t thread_index = ThreadIndex();
+	while (counter.pending.load(std::memory_order_acquire) > 0)
+	{
+		Job job;
+		if (TryPop(thread_index, job))
+		{
+			Execute(thread_index, job);
+			continue;
+		}
+
+		// The last jobs are running elsewhere
+		int64_t start = CpuProfiler::Now();
+		std::this_thread::yield();
+		if (job_depth > 0)
+			job_idle_ns += CpuProfiler::Now() - start;
+	}
+}
+
+void JobSystem::ParallelFor(const char * name, size_t count, size_t min_batch, const std::function<void(size_t begin, size_t end)>& function)
+{
+	// A few batches per thread even out batches that take longer than others
+	size_t batch_count = std::min(count / std::max<size_t>(min_batch, 1), ThreadCount() * 4);
+	if (batch_count <= 1)
+	{
+		if (count > 0)
+			function(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (size_t batch = 0; batch < batch_count; ++batch)
+	{
+		size_t begin = count * batch / batch_count, end = count * (batch + 1) / batch_count;
+		Submit(name, [&function, begin, end] { function(begin, end); }, counter);
+	}
+	Wait(counter);
+}
+
+void JobSystem::Run(JobGraph& graph)
+{
+	for (size_t job = 0; job < graph.Count(); ++job)
+		graph.remaining[job].store(graph.dependency_count[job], std::memory_order_relaxed);
+
+	// A job queues its dependents before it counts as finished, so the counter stays above zero until the end
+	JobCounter counter;
+	for (size_t job = 0; job < graph.Count(); ++job)
+		if (graph.dependency_count[job] == 0)
+			SubmitGraphJob(graph, job, counter);
+	Wait(counter);
+}
+
+void JobSystem::SubmitGraphJob(JobGraph& graph, size_t job, JobCounter& counter)
+{
+	Submit(graph.names[job], [this, &graph, job, &counter]
+	{
+		graph.functions[job]();
+		for (size_t dependent : graph.dependents[job])
+			if (graph.remaining[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+				SubmitGraphJob(graph, dependent, counter);
+	}, counter);
+}
+
+float JobSystem::TakeUtilization()
+{
+	int64_t busy = 0;
+	for (size_t i = 0; i < ThreadCount(); ++i)
+		busy += busy_ns[i].load(std::memory_order_relaxed);
+	int64_t now = CpuProfiler::Now();
+
+	int64_t available = (now - utilization_start_ns) * int64_t(ThreadCount());
+	float utilization = available > 0 ? float(double(busy - utilization_busy_ns) / double(available)) : 0.f;
+	utilization_busy_ns = busy;
+	utilization_start_ns = now;
+	return std::min(std::max(utilization, 0.f), 1.f);
+}
+
+void JobSystem::WorkerLoop(size_t thread_index)
+{
+	PROFILE_THREAD_NAME("Job worker");
+	current_system = this;
+	current_thread_index = thread_index;
+	for (;;)
+	{
+		Job job;
+		if (TryPop(thread_index, job))
+		{
+			Execute(thread_index, job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		work_available.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+		if (stopping)
+			return;
+	}
+}
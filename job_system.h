@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Job System Structs */
+
+typedef std::function<void()> JobFunction;
+
+// Jobs submitted against a counter and not finished yet. Wait on it to join them.
+struct JobCounter
+{
+	std::atomic<int> pending;
+
+	JobCounter() : pending(0) {}
+};
+
+struct Job
+{
+	const char * name; // string literal, the profiler zone of the job
+	JobFunction function;
+	JobCounter * counter;
+};
+
+// One per thread. The owner pushes and pops at the back, so it keeps working on what it submitted last while that
+// is still in cache, idle threads steal from the front, the oldest and usually largest pieces of work.
+struct JobQueue
+{
+	std::mutex mutex;
+	std::deque<Job> jobs;
+};
+
+// Jobs of one frame and the order they have to run in: a job starts once every job it depends on is done. Built
+// once and run every frame, the functions capture the frame's state by reference.
+struct JobGraph
+{
+	std::vector<const char *> names;
+	std::vector<JobFunction> functions;
+	std::vector<std::vector<size_t>> dependents;
+	std::vector<int> dependency_count;
+	std::unique_ptr<std::atomic<int>[]> remaining; // dependencies left in the running frame
+
+	size_t Add(const char * name, JobFunction function);
+	void Depend(size_t job, size_t on);
+
+	size_t Count() const { return functions.size(); }
+};
+
+// Work-stealing scheduler: a fixed set of worker threads plus the thread that created it, the main thread, each
+// with its own queue. A thread that runs out of work steals from the others, and a thread waiting for a counter
+// runs queued jobs until it drops to zero instead of sleeping, so jobs can wait for jobs they spawned themselves.
+//
+// The time every thread spends inside jobs is summed up, TakeUtilization turns it into the share of the threads'
+// time that went into jobs since its last call.
+struct JobSystem
+{
+	std::vector<std::unique_ptr<JobQueue>> queues; // queue 0 is the main thread's
+	std::vector<std::thread> workers;
+
+	// Idle workers sleep until a job is queued
+	std::mutex sleep_mutex;
+	std::condition_variable work_available;
+	std::atomic<int> queued;
+	bool stopping;
+
+	std::unique_ptr<std::atomic<int64_t>[]> busy_ns; // per thread
+	int64_t utilization_busy_ns;
+	int64_t utilization_start_ns;
+
+	JobSystem(int worker_count);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	size_t ThreadCount() const { return queues.size(); }
+
+	void Submit(const char * name, JobFunction function, JobCounter& counter);
+	void Wait(JobCounter& counter);
+
+	// Calls function(begin, end) on batches of at least min_batch of [0, count), on every thread, and returns
+	// when all are done. Runs inline when there is only one batch.
+	void ParallelFor(const char * name, size_t count, size_t min_batch, const std::function<void(size_t begin, size_t end)>& function);
+
+	// Starts the graph's jobs as their dependencies finish and returns when all are done
+	void Run(JobGraph& graph);
+
+	// Share of the time since the last call the threads spent running jobs, 0 to 1
+	float TakeUtilization();
+
+	size_t ThreadIndex() const;
+	void Push(Job job);
+	bool TryPop(size_t thread_index, Job& job);
+	void Execute(size_t thread_index, Job& job);
+	void WorkerLoop(size_t thread_index);
+	void SubmitGraphJob(JobGraph& graph, size_t job, JobCounter& counter);
+};
@@ -1,7 +1,16 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
+#if defined(__APPLE__)
 #include <mach-o/dyld.h>
+#endif
 
 #define GLM_FORCE_LEFT_HANDED
 #include "glm/glm.hpp"
@@ -16,8 +25,27 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "clustered_lighting.h"
+#include "cpu_profiler.h"
+#include "culling.h"
+#include "deferred_shading.h"
+#include "gpu_profiler.h"
+#include "headless_context.h"
+#include "input_recording.h"
+#include "job_system.h"
 #include "opengl_utilities.h"
+#include "program_cache.h"
+#include "rover_entities.h"
+#include "scene_framebuffer.h"
+#include "shader_variants.h"
+#include "shadow_maps.h"
+#include "software_occlusion.h"
+#include "texture_container.h"
+#include "texture_residency.h"
+#include "texture_streaming.h"
+#include "virtual_texture.h"
 #include "extras.h"
+#include "fixed_timestep.h"
 
 #define GLFW_KEY_RIGHT 262
 #define GLFW_KEY_LEFT 263
@@ -44,8 +72,42 @@ static struct {
     
     bool firstMouse = true;
     
+    CullingStats culling_stats; // of the last frame
+    
+    bool z_prepass = false; // toggled with Z, or MARS_Z_PREPASS=1 at startup
+    
+    bool deferred = false; // toggled with G, or MARS_DEFERRED=1 at startup
+    
+    glm::ivec2 render_size = glm::ivec2(0); // MARS_RENDER_SIZE=WxH, (0, 0) follows the window
+    
+    bool headless = false; // MARS_HEADLESS=<frames>, renders that many frames offscreen without input
+    
+    InputMode input_mode = INPUT_MODE_LIVE; // MARS_RECORD=<file> or MARS_REPLAY=<file>
+    InputRecording input;
+    GLFWcursorposfun cursor_callback = NULL; // the camera mode's, cursor events are passed on to it
+    
 } Globals;
 
+/* One mesh draw of the frame, collected before any GL work so culling can drop it */
+struct DrawItem
+{
+    const VAO * vao;
+    const ShaderVariant * variant;
+    const ShaderVariant * gbuffer_variant; // same material, written to the G-buffer instead of lit
+    glm::mat4 model;
+    glm::vec3 color;
+    bool is_static; // never moves, only these go into the cached shadow cascades
+    const char * gpu_scope; // draw group the GPU profiler times it under
+};
+
+/* What the fixed-timestep simulation moves besides the enemies, which keep their own previous positions.
+   The state before the last step is kept to draw in between. */
+struct SimulationState
+{
+    glm::vec3 player_pos;
+    glm::vec3 camera_position; // follows the rover while driving
+};
+
 float player_scale = 0.001f;
 float player_rotation = -90.f;
 glm::vec3 player_pos(0, 1.f, 0);
@@ -98,6 +160,18 @@ static void WindowSizeCallback(GLFWwindow* window, int width, int height)
 static void KeyCallBack(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
     Globals.key_pressed = key;
+    
+    if (key == GLFW_KEY_Z && action == GLFW_PRESS)
+    {
+        Globals.z_prepass = !Globals.z_prepass;
+        std::cout << "Z-prepass " << (Globals.z_prepass ? "on" : "off") << std::endl;
+    }
+    
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+    {
+        Globals.deferred = !Globals.deferred;
+        std::cout << (Globals.deferred ? "Deferred" : "Forward") << " shading" << std::endl;
+    }
 }
 
 void ScrollCallBack(GLFWwindow* window, double xoffset, double yoffset)
@@ -105,74 +179,526 @@ void ScrollCallBack(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(yoffset);
 }
 
-bool CheckCollision(glm::vec3 &player_pos, glm::vec3 &enemy_pos) // AABB - AABB collision
+/* Input and time go through these, so the headless mode runs the same loop without a GLFW window
+   and a recorded session can stand in for the window */
+static bool KeyDown(GLFWwindow* window, int key)
+{
+    if (Globals.input_mode == INPUT_MODE_REPLAY)
+        return Globals.input.ReplayKeyDown(key);
+    
+    bool down = !Globals.headless && glfwGetKey(window, key) == GLFW_PRESS;
+    if (Globals.input_mode == INPUT_MODE_RECORD)
+        Globals.input.RecordKey(key, down);
+    return down;
+}
+
+static void SetCursorPositionCallback(GLFWwindow* window, GLFWcursorposfun callback)
+{
+    Globals.cursor_callback = callback;
+}
+
+static double TimeSeconds()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Every callback event goes through here, from GLFW or from a replay
+static void DispatchInputEvent(GLFWwindow* window, const InputEvent& event)
+{
+    if (Globals.input_mode == INPUT_MODE_RECORD)
+        Globals.input.RecordEvent(event);
+    
+    switch (event.type)
+    {
+    case INPUT_EVENT_KEY:
+        KeyCallBack(window, event.key, 0, event.action, 0);
+        break;
+    case INPUT_EVENT_CURSOR:
+        if (Globals.cursor_callback != NULL)
+            Globals.cursor_callback(window, event.x, event.y);
+        break;
+    case INPUT_EVENT_SCROLL:
+        ScrollCallBack(window, event.x, event.y);
+        break;
+    }
+}
+
+// While replaying, live input is ignored
+static void OnKey(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (Globals.input_mode != INPUT_MODE_REPLAY)
+        DispatchInputEvent(window, { 0, 0, float(TimeSeconds()), int16_t(key), uint8_t(action), INPUT_EVENT_KEY });
+}
+
+static void OnCursorPosition(GLFWwindow* window, double x, double y)
 {
-    // collision x-axis?
-    bool collisionX = player_pos.x + player_scale >= enemy_pos.x &&
-        enemy_pos.x + player_scale >= player_pos.x;
-    // collision y-axis?
-    bool collisionZ = player_pos.z + player_scale >= enemy_pos.z &&
-        enemy_pos.z + player_scale >= player_pos.z;
-    // collision only if on both axes
-    return collisionX && collisionZ;
+    if (Globals.input_mode != INPUT_MODE_REPLAY)
+        DispatchInputEvent(window, { x, y, float(TimeSeconds()), 0, 0, INPUT_EVENT_CURSOR });
+}
+
+static void OnScroll(GLFWwindow* window, double xoffset, double yoffset)
+{
+    if (Globals.input_mode != INPUT_MODE_REPLAY)
+        DispatchInputEvent(window, { xoffset, yoffset, float(TimeSeconds()), 0, 0, INPUT_EVENT_SCROLL });
 }
 
 int main(void)
 {
     
 //    std::cout << fs::current_path()<<std::endl;
-    /* Set GLFW error callback */
-    glfwSetErrorCallback(ErrorCallback);
-
-    /* Initialize the library */
-    if (!glfwInit())
+    PROFILE_THREAD_NAME("Main");
+    
+    /* A fixed render size, e.g. MARS_RENDER_SIZE=3840x2160, is scaled to whatever the window is. Lets the
+       forward and deferred paths be compared at 1080p and 4k on any screen. */
+    if (auto render_size = std::getenv("MARS_RENDER_SIZE"))
+        if (std::sscanf(render_size, "%dx%d", &Globals.render_size.x, &Globals.render_size.y) != 2 || Globals.render_size.x <= 0 || Globals.render_size.y <= 0)
+            Globals.render_size = glm::ivec2(0);
+    
+    /* Benchmarks on machines without a display: MARS_HEADLESS=<frames> renders that many frames at the render
+       size (1920x1080 unless MARS_RENDER_SIZE says otherwise) into an offscreen context and prints frame times */
+    int headless_frames = 0;
+    if (auto headless = std::getenv("MARS_HEADLESS"))
+        headless_frames = std::atoi(headless);
+    Globals.headless = headless_frames > 0;
+    if (Globals.headless)
     {
-        std::cout << "Failed to initialize GLFW" << std::endl;
-        return -1;
+        if (Globals.render_size.x == 0)
+            Globals.render_size = glm::ivec2(1920, 1080);
+        Globals.screen_dimensions = Globals.render_size;
     }
-
-    /* Create a windowed mode window and its OpenGL context */
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
-    glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, GLFW_TRUE);
-    GLFWwindow* window = glfwCreateWindow(
-        Globals.screen_dimensions.x, Globals.screen_dimensions.y,
-        "Deniz Cangı", NULL, NULL
-    );
-    if (!window)
+    
+    /* MARS_RECORD=<file> saves the session's input and frame times, MARS_REPLAY=<file> plays it back instead of
+       the keyboard and mouse, with the recorded time steps or MARS_REPLAY_DT=<seconds> for every frame. Replays
+       end with the same statistics as headless runs, so two builds can be compared on the same play session. */
+    auto record_path = std::getenv("MARS_RECORD");
+    float replay_delta = 0.f;
+    if (auto replay_path = std::getenv("MARS_REPLAY"))
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+        if (!Globals.input.Read(replay_path))
+            return -1;
+        Globals.input_mode = INPUT_MODE_REPLAY;
+        if (auto fixed_delta = std::getenv("MARS_REPLAY_DT"))
+            replay_delta = float(std::atof(fixed_delta));
+        std::cout << "Replaying " << Globals.input.frames.size() << " frames from " << replay_path << std::endl;
     }
+    else if (record_path != NULL && !Globals.headless)
+        Globals.input_mode = INPUT_MODE_RECORD;
     
-    /* Move window to a certain position [do not change] */
-    glfwSetWindowPos(window, 10, 50);
-    /* Make the window's context current */
-    glfwMakeContextCurrent(window);
-    /* Enable VSync */
-//    glfwSwapInterval(1);
-
-    /* Load OpenGL extensions with GLAD */
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    HeadlessContext headless_context;
+    GLFWwindow* window = NULL;
+    if (Globals.headless && headless_context.Create(Globals.screen_dimensions.x, Globals.screen_dimensions.y))
     {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        glfwTerminate();
-        return -1;
+        if (!gladLoadGLLoader((GLADloadproc)HeadlessContext::GetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            headless_context.Destroy();
+            return -1;
+        }
     }
+    else
+    {
+        /* Set GLFW error callback */
+        glfwSetErrorCallback(ErrorCallback);
+
+        /* Initialize the library */
+        if (!glfwInit())
+        {
+            std::cout << "Failed to initialize GLFW" << std::endl;
+            return -1;
+        }
+
+        /* Create a windowed mode window and its OpenGL context, a hidden one where headless has no EGL */
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+        glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, GLFW_TRUE);
+        if (Globals.headless)
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(
+            Globals.screen_dimensions.x, Globals.screen_dimensions.y,
+            "Deniz Cangı", NULL, NULL
+        );
+        if (!window)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        
+        /* Move window to a certain position [do not change] */
+        glfwSetWindowPos(window, 10, 50);
+        /* Make the window's context current */
+        glfwMakeContextCurrent(window);
+        /* Enable VSync */
+//        glfwSwapInterval(1);
+
+        /* Load OpenGL extensions with GLAD */
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
 
-    /* Set GLFW Callbacks */
-    glfwSetCursorPosCallback(window, CursorPositionCallback_);
-    glfwSetWindowSizeCallback(window, WindowSizeCallback);
-    glfwSetKeyCallback(window, KeyCallBack);
-    glfwSetScrollCallback(window, ScrollCallBack);
+        /* Set GLFW Callbacks */
+        glfwSetCursorPosCallback(window, OnCursorPosition);
+        glfwSetWindowSizeCallback(window, WindowSizeCallback);
+        glfwSetKeyCallback(window, OnKey);
+        glfwSetScrollCallback(window, OnScroll);
+    }
 
 
     /* Configure OpenGL */
     glClearColor(0, 0, 0, 1);
     glEnable(GL_DEPTH_TEST);
+    
+    /* Reversed-Z keeps rover parts and the surface apart despite the 1e-6 near plane, MARS_REVERSED_Z=0 turns it off */
+    auto reversed_z = std::getenv("MARS_REVERSED_Z");
+    SceneFramebuffer scene_framebuffer(reversed_z != NULL && std::atoi(reversed_z) == 0 ? DEPTH_MODE_STANDARD : DEPTH_MODE_REVERSED_Z,
+        Globals.render_size.x > 0);
+
+    /* A tiled .vtex pyramid (cook_texture --virtual) replaces the regular texture with virtual texturing,
+       which keeps a fixed amount of the planet imagery in VRAM no matter how large the source is */
+    auto virtual_filename = "denizcangi_mars_texture.vtex";
+    VirtualTexture virtual_texture;
+    bool use_virtual_texture = virtual_texture.Open(virtual_filename);
+
+    /* Linked programs are reused across launches as long as sources and driver match */
+    ProgramBinaryCache program_binaries("shader_cache");
+    AsyncProgramBuilder program_builder(&program_binaries);
+
+    ShaderVariantCache shader_variants(
+        R"VERTEX(
+#version 330 core
+
+layout(location = 0) in vec3 a_position;
+layout(location = 1) in vec3 a_normal;
+layout(location = 2) in vec2 a_uv;
+
+uniform mat4 u_model;
+uniform mat4 u_projection_view;
+
+// The depth-only prepass and the shading pass must produce bit-identical depth for GL_EQUAL
+invariant gl_Position;
+                                              
+out vec4 world_space_position;
+out vec3 world_space_normal;
+out vec2 vertex_uv;
+                                              
+void main()
+{
+#if defined(DEFERRED_LIGHTING)
+    // One triangle covering the screen, straight from gl_VertexID
+    gl_Position = vec4(vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2 - 1, 0, 1);
+#else
+    world_space_position = u_model * vec4(a_position, 1);
+    world_space_normal = vec3(u_model * vec4(a_normal, 0));
+    vertex_uv = a_uv;
+    
+    gl_Position = u_projection_view * world_space_position;
+#endif
+}
+        )VERTEX",
+
+        R"FRAGMENT(
+#version 330 core
+
+uniform vec3 u_color;
+uniform sampler2D u_texture;
+
+in vec4 world_space_position;
+in vec3 world_space_normal;
+in vec2 vertex_uv;
+                                              
+#if defined(VIRTUAL_TEXTURE_FEEDBACK)
+out uint out_feedback;
+#elif defined(GBUFFER)
+layout(location = 0) out vec4 out_albedo_material;
+layout(location = 1) out vec2 out_normal;
+#elif !defined(DEPTH_ONLY)
+out vec4 out_color;
+#endif
+
+// G-buffer material ids, 0 is left for pixels nothing was drawn to
+#if defined(MATERIAL_VIRTUAL_TEXTURE) || defined(MATERIAL_TEXTURED)
+#define MATERIAL_ID 1
+#elif defined(MATERIAL_TIRE)
+#define MATERIAL_ID 3
+#else
+#define MATERIAL_ID 2
+#endif
+
+// Unit normals folded onto the octahedron and flattened into [-1, 1]^2
+vec2 OctahedralEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0)
+        e = (1 - abs(e.yx)) * vec2(e.x >= 0 ? 1 : -1, e.y >= 0 ? 1 : -1);
+    return e;
+}
+
+vec3 OctahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0);
+    n.xy += vec2(n.x >= 0 ? -t : t, n.y >= 0 ? -t : t);
+    return normalize(n);
+}
+
+#if defined(MATERIAL_VIRTUAL_TEXTURE) || defined(VIRTUAL_TEXTURE_FEEDBACK)
+uniform sampler2D u_page_table;
+uniform sampler2D u_page_atlas;
+uniform vec2 u_vt_pages;
+uniform float u_vt_mip_count;
+uniform float u_vt_page_size;
+uniform float u_vt_page_border;
+uniform float u_vt_atlas_size;
+uniform float u_vt_mip_bias;
+
+float VirtualMip(vec2 uv)
+{
+    vec2 texel = uv * u_vt_pages * u_vt_page_size;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    return clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + u_vt_mip_bias), 0, u_vt_mip_count - 1);
+}
+
+vec3 SampleVirtualTexture(vec2 uv)
+{
+    uv = clamp(uv, 0, 0.99999);
+    vec4 entry = textureLod(u_page_table, uv, VirtualMip(uv)) * 255;
+    // entry.xy is the atlas slot, entry.z the mip that slot actually holds
+    vec2 pages = max(u_vt_pages / exp2(entry.z), vec2(1));
+    float slot_size = u_vt_page_size + 2 * u_vt_page_border;
+    vec2 atlas_texel = entry.xy * slot_size + u_vt_page_border + fract(uv * pages) * u_vt_page_size;
+    return textureLod(u_page_atlas, atlas_texel / u_vt_atlas_size, 0).rgb;
+}
+
+uint VirtualTextureFeedback(vec2 uv)
+{
+    uv = clamp(uv, 0, 0.99999);
+    float mip = VirtualMip(uv);
+    uvec2 page = uvec2(uv * max(u_vt_pages / exp2(mip), vec2(1)));
+    return (uint(mip) << 24) | (page.y << 12) | page.x;
+}
+#endif
+
+#if defined(DEFERRED_LIGHTING)
+uniform sampler2D u_gbuffer_albedo;
+uniform sampler2D u_gbuffer_normal;
+uniform sampler2D u_gbuffer_depth;
+uniform mat4 u_inverse_projection_view;
+uniform vec2 u_gbuffer_size;
+uniform vec2 u_depth_to_ndc; // scale and bias, depends on glClipControl
+#endif
+
+#if !defined(DEPTH_ONLY) && !defined(VIRTUAL_TEXTURE_FEEDBACK) && !defined(GBUFFER)
+layout(std140) uniform ShadowCascades
+{
+    mat4 u_cascade_matrices[4];
+    vec4 u_cascade_splits;
+    vec4 u_cascade_texel_sizes;
+    vec4 u_light_direction;
+    vec4 u_camera_position;
+    vec4 u_camera_forward;
+};
+uniform sampler2DArrayShadow u_shadow_map;
+
+float ShadowFactor(vec3 position, vec3 normal)
+{
+    float depth = dot(position - u_camera_position.xyz, u_camera_forward.xyz);
+    if (u_light_direction.w == 0 || depth > u_cascade_splits[3])
+        return 1.0;
+
+    int cascade = 0;
+    while (cascade < 3 && depth > u_cascade_splits[cascade])
+        cascade++;
+
+    // Pushing the lookup out along the normal by a texel or two keeps curved surfaces free of acne
+    vec3 offset_position = position + normal * 1.5 * u_cascade_texel_sizes[cascade];
+    vec3 coords = (u_cascade_matrices[cascade] * vec4(offset_position, 1)).xyz * 0.5 + 0.5;
+    if (coords.z > 1)
+        return 1.0;
+
+    // 2x2 hardware PCF taps
+    vec2 texel = 1.0 / vec2(textureSize(u_shadow_map, 0).xy);
+    float lit = 0;
+    for (int i = 0; i < 4; ++i)
+        lit += texture(u_shadow_map, vec4(coords.xy + (vec2(i & 1, i >> 1) - 0.5) * texel, cascade, coords.z));
+    return lit / 4;
+}
+
+layout(std140) uniform ClusteredLights
+{
+    vec4 u_cluster_camera_position;
+    vec4 u_cluster_camera_forward;
+    vec4 u_cluster_grid_size;
+    vec4 u_cluster_depth;
+    vec4 u_cluster_screen;
+};
+uniform usamplerBuffer u_cluster_grid;
+uniform usamplerBuffer u_cluster_light_indices;
+uniform samplerBuffer u_light_data;
+
+// Only the lights binned into this fragment's cluster, however many there are in total
+vec3 ClusteredLighting(vec3 position, vec3 normal, vec3 albedo)
+{
+    float depth = dot(position - u_cluster_camera_position.xyz, u_cluster_camera_forward.xyz);
+    if (u_cluster_grid_size.w == 0 || depth <= 0)
+        return vec3(0);
+
+    ivec3 size = ivec3(u_cluster_grid_size.xyz);
+    ivec3 cluster = ivec3(gl_FragCoord.xy / u_cluster_screen.xy * u_cluster_grid_size.xy,
+                          log(max(depth, u_cluster_depth.x) / u_cluster_depth.x) * u_cluster_depth.z);
+    if (cluster.z >= size.z)
+        return vec3(0);
+    cluster.xy = clamp(cluster.xy, ivec2(0), size.xy - 1);
+
+    uvec2 range = texelFetch(u_cluster_grid, (cluster.z * size.y + cluster.y) * size.x + cluster.x).xy;
+
+    vec3 result = vec3(0);
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        int light = int(texelFetch(u_cluster_light_indices, int(range.x + i)).x);
+        vec4 position_range = texelFetch(u_light_data, light * 3);
+        vec4 color_cone = texelFetch(u_light_data, light * 3 + 1);
+        vec3 spot_direction = texelFetch(u_light_data, light * 3 + 2).xyz;
+
+        vec3 to_light = position_range.xyz - position;
+        float distance = length(to_light);
+        vec3 light_direction = to_light / distance;
+
+        // Windowed falloff, exactly zero at the range the binning used
+        float falloff = clamp(1 - (distance * distance) / (position_range.w * position_range.w), 0, 1);
+        float attenuation = falloff * falloff;
+        if (color_cone.w > -1)
+            attenuation *= smoothstep(color_cone.w, mix(color_cone.w, 1, 0.2), dot(-light_direction, spot_direction));
+
+        result += max(0, dot(normal, light_direction)) * attenuation * color_cone.rgb * albedo;
+    }
+    return result;
+}
+#endif
+
+void main()
+{
+#if defined(DEPTH_ONLY)
+    // Depth is all the prepass writes
+#elif defined(VIRTUAL_TEXTURE_FEEDBACK)
+    out_feedback = VirtualTextureFeedback(vertex_uv);
+#else
+#if defined(DEFERRED_LIGHTING)
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 albedo_material = texelFetch(u_gbuffer_albedo, pixel, 0);
+    if (albedo_material.a == 0)
+        discard;
+
+    float depth = texelFetch(u_gbuffer_depth, pixel, 0).r;
+    vec4 position = u_inverse_projection_view * vec4(gl_FragCoord.xy / u_gbuffer_size * 2 - 1, depth * u_depth_to_ndc.x + u_depth_to_ndc.y, 1);
+
+    vec3 surface_position = position.xyz / position.w;
+    vec3 surface_normal = OctahedralDecode(texelFetch(u_gbuffer_normal, pixel, 0).xy * 2 - 1);
+    vec3 surface_color = albedo_material.rgb;
+#else
+    vec3 surface_position = world_space_position.xyz;
+    vec3 surface_normal = normalize(world_space_normal);
+    vec2 surface_uv = vertex_uv;
+#if defined(MATERIAL_VIRTUAL_TEXTURE)
+    vec3 surface_color = SampleVirtualTexture(surface_uv);
+#elif defined(MATERIAL_TEXTURED)
+    vec3 surface_color = texture(u_texture, surface_uv).rgb;
+#elif defined(MATERIAL_TIRE)
+    vec3 surface_color = vec3(0);
+#else
+    vec3 surface_color = u_color;
+#endif
+#endif
+
+#if defined(GBUFFER)
+    out_albedo_material = vec4(surface_color, MATERIAL_ID / 255.0);
+    out_normal = OctahedralEncode(surface_normal) * 0.5 + 0.5;
+#else
+    vec3 color = vec3(0);
+    vec3 ambient_color = vec3(0.5);
+                                    
+    vec3 light_direction = u_light_direction.xyz;
+    vec3 light_color = vec3(0.35) * ShadowFactor(surface_position, surface_normal);
+                                    
+    float diffuse_intensity = max(0,dot(light_direction, surface_normal));
+
+    vec3 view_dir = vec3(0,0,-1);
+    vec3 halfway_dir = normalize(view_dir + light_direction);
+    float shininess =  64;
+    float specular_intensity = max(0, dot(halfway_dir, surface_normal));
+                                        
+    color += ambient_color * surface_color + diffuse_intensity * light_color * surface_color + pow(specular_intensity, shininess) * light_color;
+    color += ClusteredLighting(surface_position, surface_normal, surface_color);
+                                 
+    out_color = vec4(color, 1);
+#endif
+#endif
+}
+        )FRAGMENT",
+        program_builder);
+
+    /* Kick off every permutation the scene uses, the driver compiles them while we load assets */
+    const unsigned planet_features = use_virtual_texture ? SHADER_FEATURE_VIRTUAL_TEXTURE : SHADER_FEATURE_TEXTURED;
+    shader_variants.Request(planet_features);
+    if (use_virtual_texture)
+        shader_variants.Request(SHADER_FEATURE_VIRTUAL_TEXTURE_FEEDBACK);
+    shader_variants.Request(SHADER_FEATURE_FLAT_COLOR);
+    shader_variants.Request(SHADER_FEATURE_TIRE);
+    shader_variants.Request(SHADER_FEATURE_DEPTH_ONLY);
+    shader_variants.Request(planet_features | SHADER_FEATURE_GBUFFER);
+    shader_variants.Request(SHADER_FEATURE_FLAT_COLOR | SHADER_FEATURE_GBUFFER);
+    shader_variants.Request(SHADER_FEATURE_TIRE | SHADER_FEATURE_GBUFFER);
+    shader_variants.Request(SHADER_FEATURE_DEFERRED_LIGHTING);
+    program_builder.LinkAll();
+
+#if defined(__APPLE__)
+    char path[2048];
+    uint32_t size = sizeof(path);
+    if (_NSGetExecutablePath(path, &size) == 0)
+        printf("executable path is %s\n", path);
+    else
+        printf("buffer too small; need size %u\n", size);
+#endif
+    
+    stbi_set_flip_vertically_on_load(true);
+    /*
+    const std::string filename = fs::absolute(fs::current_path()).c_str();
+    std::cout << filename << std::endl;
+    
+    char buff[FILENAME_MAX]; //create string buffer to hold path
+    GetCurrentDir(buff, FILENAME_MAX);
+    std::string current_working_dir(buff);*/
+    /*
+    std::string path_s(path);
+//    std::cout << path_s.rfind("/") << std::endl;
+    path_s = path_s.substr(0,path_s.rfind("/"));
+    std::string filename = path_s + "/denizcangi_mars_texture.jpg";
+//    std::cout << filename << std::endl;
+//    std::cout << current_working_dir << std::endl;
+    char* char_array;
+    char_array = &filename[0];*/
+    
+    auto filename = "denizcangi_mars_texture.jpg";
+    auto cooked_filename = "denizcangi_mars_texture.mtex"; // made by cook_texture from the jpg
+    
+    /* The cooked container needs neither decoding nor runtime mipmap generation, so it wins when present */
+    MappedTextureContainer cooked_texture;
+    bool use_cooked_texture = !use_virtual_texture && cooked_texture.Open(cooked_filename);
+    
+    /* Otherwise stream the jpg: workers decode it while the meshes are generated, and until
+       its mips arrive the planet is drawn with a flat dusty placeholder */
+    const uint32_t mars_placeholder_color = 0xB4643C;
+    TextureStreamer texture_streamer;
+    GLuint texture_1 = NULL;
+    if (!use_virtual_texture && !use_cooked_texture)
+        texture_1 = texture_streamer.Request(filename, mars_placeholder_color);
 
     /* Creating OpenGL objects */
     std::vector<glm::vec3> positions;
@@ -182,6 +708,7 @@ int main(void)
 
     GenerateParametricShapeFrom2D(positions, normals, uvs, indices, ParametricHalfCircle, 256, 256);
     VAO sphereVAO(positions, normals, uvs, indices);
+    auto sphere_bounds = ComputeBoundingSphere(positions);
     
     positions.clear();
     normals.clear();
@@ -190,6 +717,17 @@ int main(void)
     
     GenerateParametricShapeFrom2D(positions, normals, uvs, indices, ParametricCircle, 16, 16);
     VAO torusVAO(positions, normals, uvs, indices);
+    auto torus_bounds = ComputeBoundingSphere(positions);
+    
+    positions.clear();
+    normals.clear();
+    uvs.clear();
+    indices.clear();
+    
+    /* Low-poly Mars for the CPU occlusion buffer, future craters and rocks get added next to it */
+    GenerateParametricShapeFrom2D(positions, normals, uvs, indices, ParametricHalfCircle, 16, 32);
+    SoftwareOcclusion occlusion;
+    size_t mars_occluder = occlusion.AddOccluder(positions, indices);
     
     VAO cubeVAO(
     {
@@ -286,178 +824,139 @@ int main(void)
     }
     );
     
-    char path[2048];
-    uint32_t size = sizeof(path);
-    if (_NSGetExecutablePath(path, &size) == 0)
-        printf("executable path is %s\n", path);
-    else
-        printf("buffer too small; need size %u\n", size);
-    
-    stbi_set_flip_vertically_on_load(true);
-    /*
-    const std::string filename = fs::absolute(fs::current_path()).c_str();
-    std::cout << filename << std::endl;
-    
-    char buff[FILENAME_MAX]; //create string buffer to hold path
-    GetCurrentDir(buff, FILENAME_MAX);
-    std::string current_working_dir(buff);*/
-    /*
-    std::string path_s(path);
-//    std::cout << path_s.rfind("/") << std::endl;
-    path_s = path_s.substr(0,path_s.rfind("/"));
-    std::string filename = path_s + "/denizcangi_mars_texture.jpg";
-//    std::cout << filename << std::endl;
-//    std::cout << current_working_dir << std::endl;
-    char* char_array;
-    char_array = &filename[0];*/
-    
-    auto filename = "denizcangi_mars_texture.jpg";
-    
-    int x, y, n;
-    unsigned char *texture_data_1 = stbi_load(filename, &x, &y, &n, 0);
-    if (texture_data_1 == NULL)
-    {
-        std::cout << "Texture " << filename << " failed to load." << std::endl;
-        std::cout << "Error: " << stbi_failure_reason() << std::endl;
-        if(stbi_failure_reason())
-            std::cout << stbi_failure_reason();
-    }
-    else
+    if (use_cooked_texture)
     {
-        std::cout << "Texture " << filename << " is loaded, X:" << x << " Y:" << y << " N:" << n << std::endl;
+        texture_1 = CreateTextureFromContainer(cooked_texture);
+        if (texture_1 != NULL)
+            std::cout << "Texture " << cooked_filename << " is loaded, X:" << cooked_texture.header->width << " Y:" << cooked_texture.header->height << " mips:" << cooked_texture.header->mip_count << std::endl;
+        else
+            cooked_texture.Close(); // otherwise it stays mapped, evicted mips are reloaded from it
     }
-
-    GLuint texture_1;
-    glGenTextures(1, &texture_1);
     
-    if (x * n % 4 != 0){
-        glPixelStorei(GL_UNPACK_ALIGNMENT,1);
-    }
+    if (texture_1 == NULL && !use_virtual_texture)
+        texture_1 = texture_streamer.Request(filename, mars_placeholder_color);
 
     glBindTexture(GL_TEXTURE_2D, texture_1);
-    glTexImage2D(
-        GL_TEXTURE_2D,
-        0,
-        GL_RGB,
-        x, y, 0, GL_RGB, GL_UNSIGNED_BYTE, texture_data_1
-    ); //texture
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    
-    glGenerateMipmap(GL_TEXTURE_2D);
 
-    stbi_image_free(texture_data_1);
-
-
-    GLuint program = CreateProgramFromSources(
-        R"VERTEX(
-#version 330 core
-
-layout(location = 0) in vec3 a_position;
-layout(location = 1) in vec3 a_normal;
-layout(location = 2) in vec2 a_uv;
-
-uniform mat4 u_model;
-uniform mat4 u_projection_view;
-                                              
-out vec4 world_space_position;
-out vec3 world_space_normal;
-out vec2 vertex_uv;
-                                              
-void main()
-{
-    world_space_position = u_model * vec4(a_position, 1);
-    world_space_normal = vec3(u_model * vec4(a_normal, 0));
-    vertex_uv = a_uv;
+    /* Mips finer than what the camera can resolve are given back when over the VRAM budget (MARS_TEXTURE_BUDGET_MB) */
+    size_t texture_budget_bytes = size_t(64) << 20;
+    if (auto budget = std::getenv("MARS_TEXTURE_BUDGET_MB"))
+        texture_budget_bytes = size_t(std::atoi(budget)) << 20;
+    TextureResidencyManager texture_residency(texture_budget_bytes);
     
-    gl_Position = u_projection_view * world_space_position;
-}
-        )VERTEX",
-
-        R"FRAGMENT(
-#version 330 core
-
-uniform vec2 u_mouse_position;
-uniform float u_material;
-uniform sampler2D u_texture;
-
-in vec4 world_space_position;
-in vec3 world_space_normal;
-in vec2 vertex_uv;
-                                              
-out vec4 out_color;
-
-void main()
-{
-    vec3 color = vec3(0);
-
-    vec3 surface_position = world_space_position.xyz;
-    vec3 surface_normal = normalize(world_space_normal);
-    vec2 surface_uv = vertex_uv;
-    vec3 surface_color;
-    if (u_material == 1)
-    {
-        surface_color = vec3(255/255.f, 241/255.f, 38/255.f);
-    }
-    else if (u_material == 2)
-    {
-        surface_color = texture(u_texture, surface_uv).rgb;
-    }
-    else if (u_material == 3)
-    {
-        surface_color = vec3(0);
-    }
-    else if (u_material == 4)
-    {
-        surface_color = vec3(150/255.f, 30/255.f, 30/255.f);
-    }
-    else if (u_material == 5)
+    bool texture_1_registered = false;
+    auto register_texture_1 = [&]()
     {
-        surface_color = vec3(0/255.f, 153/255.f, 0/255.f);
-    }
-    vec3 ambient_color = vec3(0.5);
-                                    
-    vec3 light_direction = normalize(vec3(1,1,-1));
-    vec3 light_color = vec3(0.35);
-                                    
-    float diffuse_intensity = max(0,dot(light_direction, surface_normal));
+        if (use_cooked_texture && cooked_texture.header != NULL)
+        {
+            texture_residency.RegisterCompressed(texture_1, cooked_texture.header->width, cooked_texture.header->height,
+                cooked_texture.header->mip_count, cooked_texture.header->gl_internal_format,
+                [&](int level, std::vector<unsigned char>& data)
+                {
+                    data.assign(cooked_texture.MipData(level), cooked_texture.MipData(level) + cooked_texture.mips[level].size);
+                    return true;
+                });
+            return true;
+        }
+        
+        // Streamed textures join once fully uploaded, the streamer decodes them again if evicted levels come back
+        if (!texture_streamer.IsComplete(texture_1))
+            return false;
+        for (const auto& streamed : texture_streamer.textures)
+            if (streamed.texture == texture_1 && !streamed.failed)
+                texture_residency.Register(texture_1, streamed.mips[0].width, streamed.mips[0].height, int(streamed.mips.size()),
+                    GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE,
+                    [&](int level, std::vector<unsigned char>& data) { return texture_streamer.ReadLevel(texture_1, level, data); },
+                    [&]() { texture_streamer.ReleaseLevels(texture_1); });
+        return true;
+    };
 
-    vec3 view_dir = vec3(0,0,-1);
-    vec3 halfway_dir = normalize(view_dir + light_direction);
-    float shininess =  64;
-    float specular_intensity = max(0, dot(halfway_dir, surface_normal));
-                                        
-    color += ambient_color * surface_color + diffuse_intensity * light_color * surface_color + pow(specular_intensity, shininess) * light_color;
-                                 
-    out_color = vec4(color, 1);
-}
-        )FRAGMENT");
-    if (program == NULL)
+
+    /* First use of the permutations, this is where we wait for the compiler if it is not done yet */
+    auto planet_variant = shader_variants.Get(planet_features);
+    auto rover_variant = shader_variants.Get(SHADER_FEATURE_FLAT_COLOR);
+    auto tire_variant = shader_variants.Get(SHADER_FEATURE_TIRE);
+    auto depth_variant = shader_variants.Get(SHADER_FEATURE_DEPTH_ONLY);
+    auto feedback_variant = use_virtual_texture ? shader_variants.Get(SHADER_FEATURE_VIRTUAL_TEXTURE_FEEDBACK) : NULL;
+    auto planet_gbuffer_variant = shader_variants.Get(planet_features | SHADER_FEATURE_GBUFFER);
+    auto rover_gbuffer_variant = shader_variants.Get(SHADER_FEATURE_FLAT_COLOR | SHADER_FEATURE_GBUFFER);
+    auto tire_gbuffer_variant = shader_variants.Get(SHADER_FEATURE_TIRE | SHADER_FEATURE_GBUFFER);
+    auto lighting_variant = shader_variants.Get(SHADER_FEATURE_DEFERRED_LIGHTING);
+    if (planet_variant == NULL || rover_variant == NULL || tire_variant == NULL || depth_variant == NULL || (use_virtual_texture && feedback_variant == NULL) ||
+        planet_gbuffer_variant == NULL || rover_gbuffer_variant == NULL || tire_gbuffer_variant == NULL || lighting_variant == NULL)
     {
+        headless_context.Destroy();
         glfwTerminate();
         return -1;
     }
-    glUseProgram(program);
-
-    auto texture_location = glGetUniformLocation(program, "u_texture"); //texture
-    glUniform1i(texture_location, 0);
+    
+    if (use_virtual_texture)
+    {
+        virtual_texture.SetupProgram(planet_variant->program, false);
+        virtual_texture.SetupProgram(planet_gbuffer_variant->program, false);
+        virtual_texture.SetupProgram(feedback_variant->program, true);
+        virtual_texture.Bind();
+    }
+    
+    /* Sun shadows: near cascades for the rovers every frame, far ones for the planet cached */
+    const glm::vec3 light_direction = glm::normalize(glm::vec3(1, 1, -1));
+    CascadedShadowMaps shadow_maps;
+    for (auto variant : { planet_variant, rover_variant, tire_variant, lighting_variant })
+        shadow_maps.SetupProgram(variant->program);
+    shadow_maps.Bind();
+    
+    /* Simulation, render preparation and light binning run as jobs on one worker per core besides the main thread,
+       MARS_JOB_THREADS=<n> sets the worker count, 0 keeps everything on the main thread */
+    int job_threads = std::max(int(std::thread::hardware_concurrency()) - 1, 0);
+    if (auto threads = std::getenv("MARS_JOB_THREADS"))
+        job_threads = std::max(std::atoi(threads), 0);
+    JobSystem jobs(job_threads);
+    
+    /* Rover headlights and whatever local lights come later, binned per froxel */
+    ClusteredLighting clustered_lighting(&jobs);
+    for (auto variant : { planet_variant, rover_variant, tire_variant, lighting_variant })
+        clustered_lighting.SetupProgram(variant->program);
+    clustered_lighting.Bind();
+    
+    /* The deferred path lays the same materials down into a G-buffer and lights every covered pixel once */
+    DeferredShading deferred_shading;
+    deferred_shading.SetupLightingProgram(lighting_variant->program);
+    if (auto deferred = std::getenv("MARS_DEFERRED"))
+        Globals.deferred = std::atoi(deferred) != 0;
     
     glActiveTexture(GL_TEXTURE0); // activate the texture unit first before binding texture
     glBindTexture(GL_TEXTURE_2D, texture_1);
     
-    auto mouse_location = glGetUniformLocation(program, "u_mouse_position");
-    auto model_location = glGetUniformLocation(program, "u_model");
-    auto projection_view_location = glGetUniformLocation(program, "u_projection_view");
+    /* Flat rover colors, formerly u_material 1, 3, 4 and 5 */
+    const glm::vec3 player_color(255/255.f, 241/255.f, 38/255.f);
+    const glm::vec3 caught_color(0);
+    const glm::vec3 enemy_color(150/255.f, 30/255.f, 30/255.f);
+    const glm::vec3 winner_color(0/255.f, 153/255.f, 0/255.f);
     
-    auto material_location = glGetUniformLocation(program, "u_material");
+    const ShaderVariant * current_variant = NULL;
+    glm::mat4 view_projection;
+    
+    // Programs keep their own uniforms, so the view-projection is re-sent whenever we switch
+    const auto use_variant = [&](const ShaderVariant * variant)
+    {
+        if (variant == current_variant)
+            return;
+        current_variant = variant;
+        glUseProgram(variant->program);
+        glUniformMatrix4fv(variant->projection_view_location, 1, GL_FALSE, glm::value_ptr(view_projection));
+    };
     
     //Camera parameters
     
     float aspect = 1.f, near = 0.000001f, far = 100000.f;
+    if (Globals.render_size.x > 0)
+        aspect = float(Globals.render_size.x) / Globals.render_size.y;
     
     glm::vec3 sphere_pos(0,0,0);
     float sphere_scale = 1.f;
@@ -469,316 +968,701 @@ void main()
     auto player_scaling = glm::scale(glm::vec3(player_scale));
     auto player_transform = player_translate * player_scaling * player_rotation;
     
-    auto enemy_1_pos = glm::vec3(player_pos + glm::vec3(10,0,-20) * player_scale);
-    auto enemy_1_translate = glm::translate(enemy_1_pos);
-    auto enemy_1_rotation = glm::rotate(glm::radians(0.f), glm::vec3(1,1.f,1.f));
-    auto enemy_1_scaling = glm::scale(glm::vec3(player_scale));
+    /* Two enemies ahead of the player, MARS_ENEMIES=<count> spreads more on a spiral around it */
+    RoverEntities enemies;
+    size_t enemy_count = 2;
+    if (auto count = std::getenv("MARS_ENEMIES"))
+        enemy_count = size_t(std::max(std::atoi(count), 0));
+    for (size_t i = 0; i < enemy_count; ++i)
+    {
+        glm::vec3 offset(i == 0 ? 10 : -10, 0, -20);
+        if (i >= 2)
+        {
+            float angle = float(i) * 2.39996323f; // golden angle, no two rovers line up
+            float distance = 20.f + 3.f * std::sqrt(float(i));
+            offset = glm::vec3(std::cos(angle) * distance, 0, std::sin(angle) * distance);
+        }
+        enemies.Spawn(player_pos + offset * player_scale, ROVER_MATERIAL_ENEMY, ROVER_AI_PURSUE);
+    }
+    auto enemy_scaling = glm::scale(glm::vec3(player_scale));
+    std::vector<glm::mat4> enemy_transforms;
+    
+    /* Collision candidates come from a grid of rover sized cells rebuilt every step, in bands on the job threads
+       from a few ten thousand enemies */
+    SpatialHash broadphase(player_scale, &jobs);
+    std::vector<uint32_t> player_contacts;
+    std::vector<RoverPair> enemy_contacts;
+    
+    /* MARS_SEPARATION=1 also finds overlapping enemy pairs and pushes them apart, so big crowds spread out
+       instead of stacking up on the player. Off by default, enemies drive through each other as they always did */
+    bool separate_enemies = false;
+    if (auto separation = std::getenv("MARS_SEPARATION"))
+        separate_enemies = std::atoi(separation) != 0;
+    
+    /* MARS_FLOW_FIELD=<cells per cube face edge> makes the enemies follow a flow field over the planet toward the
+       player instead of each heading straight for it, e.g. 128 for cells of about twelve rover lengths */
+    int flow_field_cells = 0;
+    if (auto cells = std::getenv("MARS_FLOW_FIELD"))
+        flow_field_cells = std::max(std::atoi(cells), 0);
+    FlowField flow_field(flow_field_cells, sphere_pos, sphere_scale);
+    
+    const BoundingSphere cube_bounds = { glm::vec3(0), std::sqrt(3.f) / 2.f }; // unit cube
+    
+    const std::vector<glm::vec3> tire_positions{
+        glm::vec3(0.58,-0.5,0.5),
+        glm::vec3(0.58,-0.5,-0.5),
+        glm::vec3(-0.58,-0.5,0.5),
+        glm::vec3(-0.58,-0.5,-0.5)
+    };
+    
+    std::vector<DrawItem> draw_items;
+    std::vector<size_t> draw_order;
+    CullingSet culling_set;
     
-    auto enemy_2_pos = glm::vec3(player_pos + glm::vec3(-10,0,-20) * player_scale);
-    auto enemy_2_translate = glm::translate(enemy_2_pos);
-    auto enemy_2_rotation = glm::rotate(glm::radians(0.f), glm::vec3(1,1.f,1.f));
-    auto enemy_2_scaling = glm::scale(glm::vec3(player_scale));
+    if (auto prepass = std::getenv("MARS_Z_PREPASS"))
+        Globals.z_prepass = std::atoi(prepass) != 0;
+    
+    /* Samples that reach the shading pass, read back when the query comes round again four frames later and
+       skipped if the GPU has not finished it yet, so measuring never stalls. Printed every few seconds to compare
+       the fragment work with and without the prepass, and forward against deferred. */
+    const size_t shading_query_count = 4;
+    GLuint shading_queries[shading_query_count];
+    glGenQueries(GLsizei(shading_query_count), shading_queries);
+    bool shading_query_issued[shading_query_count] = { false, false, false, false };
+    size_t shading_frame = 0;
+    GLuint64 shading_samples_sum = 0;
+    unsigned shading_samples_frames = 0;
+    double shading_report_time = TimeSeconds();
+    
+    /* GPU time per pass and per draw group, printed with the samples. MARS_GPU_PROFILE=<file>.csv or .json
+       writes the last few seconds of it on exit. */
+    GpuProfiler gpu_profiler;
+    auto gpu_profile_path = std::getenv("MARS_GPU_PROFILE");
+    
+    // Passes show up both in the GPU report and as zones in the CPU trace
+    const auto begin_pass = [&](const char * name)
+    {
+        PROFILE_BEGIN(name);
+        gpu_profiler.BeginScope(name);
+    };
+    const auto end_pass = [&]()
+    {
+        gpu_profiler.EndScope();
+        PROFILE_END();
+    };
+    
+    /* Built with MARS_PROFILING, MARS_CPU_TRACE=<file>.json writes the CPU zones of the last frames on exit */
+    auto cpu_trace_path = std::getenv("MARS_CPU_TRACE");
     
     Camera savedCamera;
     bool goOn = true;
     bool moveForward = true;
     bool action = false;
     bool collision = false;
+    bool caught = false;
     
-    auto enemy1_saved_pos = enemy_1_pos;
-    auto enemy2_saved_pos = enemy_2_pos;
-
-    /* Loop until the user closes the window */
-    while (!glfwWindowShouldClose(window))
+    /* Driving, enemy pursuit and collision advance in fixed steps, 120 per second or MARS_SIM_HZ, whatever the
+       frame rate. Rendering interpolates between the last two steps. */
+    double simulation_hz = 120.0;
+    if (auto hz = std::getenv("MARS_SIM_HZ"))
+        simulation_hz = std::max(std::atof(hz), 1.0);
+    FixedTimestep simulation_clock(simulation_hz);
+    SimulationState previous_state = { player_pos, camera.Position };
+    
+    // Enemies used to close 0.1% of the gap every rendered frame. By default that is now 0.1% per 1/60 s whatever
+    // the step, MARS_PURSUIT=lerp keeps 0.1% per step.
+    PursuitMode pursuit_mode = PURSUIT_EXPONENTIAL;
+    if (auto pursuit = std::getenv("MARS_PURSUIT"))
+        if (std::string(pursuit) == "lerp")
+            pursuit_mode = PURSUIT_LERP;
+    const float enemy_gap_kept = PursuitGapKept(pursuit_mode, float(simulation_clock.step_seconds));
+    
+    // Arrow keys held this frame, read once so every step of the frame drives the same way
+    bool key_up = false, key_down = false, key_left = false, key_right = false;
+    
+    const auto simulate = [&](float step_seconds)
     {
         if(goOn == true){
-            if(glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS){
-                camera.ProcessKeyboard(FORWARD, Globals.deltaTime);
-                auto z = Globals.deltaTime * SPEED;
+            auto z = step_seconds * SPEED;
+            if(key_up){
+                camera.ProcessKeyboard(FORWARD, step_seconds);
                 player_pos = player_pos + Front * z;
-                player_translate = glm::translate(player_pos);
-                player_transform = player_translate * player_scaling * player_rotation;
-                moveForward= true;
-                action= true;
             }
-            if(glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS){
-                camera.ProcessKeyboard(BACKWARD, Globals.deltaTime);
-                auto z = Globals.deltaTime * SPEED;
+            if(key_down){
+                camera.ProcessKeyboard(BACKWARD, step_seconds);
                 player_pos = player_pos - Front * z;
-                player_translate = glm::translate(player_pos);
-                player_transform = player_translate * player_scaling * player_rotation;
-                moveForward= false;
-                action= true;
             }
-            if(glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS){
-                camera.ProcessKeyboard(RIGHT, Globals.deltaTime);
-                auto z = Globals.deltaTime * SPEED;
+            if(key_left){
+                camera.ProcessKeyboard(RIGHT, step_seconds);
                 player_pos = player_pos + Right * z;
-                player_translate = glm::translate(player_pos);
-                player_transform = player_translate * player_scaling * player_rotation;
             }
-            if(glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS){
-                camera.ProcessKeyboard(LEFT, Globals.deltaTime);
-                auto z = Globals.deltaTime * SPEED;
+            if(key_right){
+                camera.ProcessKeyboard(LEFT, step_seconds);
                 player_pos = player_pos - Right * z;
-                player_translate = glm::translate(player_pos);
-                player_transform = player_translate * player_scaling * player_rotation;
             }
-            if(glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS){
+        }
+        
+        // Once an enemy has the player, all of them stop and turn green
+        PROFILE_BEGIN("Collision");
+        broadphase.Build(enemies.x.data(), enemies.z.data(), enemies.Count());
+        broadphase.Query(player_pos.x, player_pos.z, player_contacts);
+        caught = !player_contacts.empty();
+        if (separate_enemies){
+            broadphase.FindPairs(enemy_contacts);
+            SeparateRovers(enemies, enemy_contacts, player_scale);
+        }
+        if (caught){
+            SetCursorPositionCallback(window, CursorPositionCallback);
+            goOn = false;
+            if (!collision)
+                SetAllRovers(enemies, ROVER_MATERIAL_WINNER, ROVER_AI_IDLE);
+            collision = true;
+        }
+        PROFILE_END();
+        
+        PROFILE_BEGIN("Enemy update");
+        if (flow_field_cells > 0){
+            flow_field.Update(player_pos);
+            jobs.ParallelFor("Flow field pursuit", enemies.Count(), 4096, [&](size_t begin, size_t end)
+            {
+                FollowFlowField(enemies, flow_field, player_pos, enemy_gap_kept, step_seconds, 2.f * flow_field.CellSize(), begin, end);
+            });
+        }
+        else
+            jobs.ParallelFor("Pursuit", enemies.Count(), 16384, [&](size_t begin, size_t end)
+            {
+                PursueTarget(enemies, player_pos, enemy_gap_kept, step_seconds, begin, end);
+            });
+        PROFILE_END();
+    };
+
+    FrameTimeStats frame_times;
+    FrameTimeStats cpu_times("CPU time"); // up to the swap, without waiting for the GPU
+    int frames_rendered = 0;
+    
+    Globals.cursor_callback = CursorPositionCallback_;
+    
+    // Headless runs end after their frames and replays with the recording, the window when it is closed
+    const auto running = [&]()
+    {
+        if (Globals.input_mode == INPUT_MODE_REPLAY && Globals.input.ReplayFinished())
+            return false;
+        if (Globals.headless)
+            return Globals.input_mode == INPUT_MODE_REPLAY || frames_rendered < headless_frames;
+        return !glfwWindowShouldClose(window);
+    };
+
+    /* The frame's CPU work ahead of the GL calls as a job graph: the simulation steps, then the interpolated
+       transforms and camera, then the draw list and the headlights side by side, then culling and sorting. The
+       steps inside them spread the rovers over all job threads. */
+    int simulation_steps = 0;
+    Camera render_camera;
+    glm::mat4 view(1.f), projection(1.f), mars_transform(1.f);
+    bool enemy_spin_forward = false, enemy_spin_backward = false;
+    double job_utilization_sum = 0.0, job_utilization_run_sum = 0.0; // since the last report, over the whole run
+    unsigned job_utilization_frames = 0;
+    
+    // Every rover is a body and its tires, consecutive draw items filled in by index from any thread
+    const size_t mars_item = 0;
+    const size_t items_per_rover = 1 + tire_positions.size();
+    const auto submit = [&](size_t index, const char * gpu_scope, const VAO& vao, const ShaderVariant * variant, const ShaderVariant * gbuffer_variant, const glm::mat4& model, const BoundingSphere& bounds, const glm::vec3& color, bool is_static)
+    {
+        draw_items[index] = { &vao, variant, gbuffer_variant, model, color, is_static, gpu_scope };
+        culling_set.Set(index, TransformBoundingSphere(bounds, model));
+    };
+    
+    const auto submit_rover = [&](size_t index, const glm::mat4& rover_transform, const glm::vec3& color, bool spin_forward, bool spin_backward)
+    {
+        submit(index, "Rover bodies", cubeVAO, rover_variant, rover_gbuffer_variant, rover_transform, cube_bounds, color, false);
+        
+        for (size_t tire = 0; tire < tire_positions.size(); ++tire){
+            auto tire_scaling = glm::scale(glm::vec3(0.3));
+            auto tire_translate = glm::translate(glm::vec3(tire_positions[tire]));
+            auto tire_transform = rover_transform * tire_translate * tire_scaling * glm::rotate(glm::radians(90.f), glm::vec3(0,0,1));
+            
+            if (spin_forward) {
+                tire_transform *= glm::rotate(glm::radians(Globals.lastFrame *1000.f), glm::vec3(0,1,0));
+            }
+            if (spin_backward) {
+                tire_transform *= glm::rotate(glm::radians(Globals.lastFrame *1000.f), glm::vec3(0,-1,0));
+            }
+            submit(index + 1 + tire, "Tires", torusVAO, tire_variant, tire_gbuffer_variant, tire_transform, torus_bounds, glm::vec3(0), false);
+        }
+    };
+    
+    /* Two headlights on the front of every rover near enough to light up anything in view, pointing along
+       its -z and slightly down */
+    const auto add_headlights = [&](const glm::mat4& rover_transform, std::vector<ClusteredLight>& lights)
+    {
+        auto direction = glm::normalize(glm::vec3(rover_transform * glm::vec4(0, -0.2f, -1, 0)));
+        for (float side : { -0.3f, 0.3f })
+        {
+            ClusteredLight headlight;
+            headlight.position = glm::vec3(rover_transform * glm::vec4(side, 0, -0.55f, 1));
+            headlight.range = 8.f * player_scale;
+            headlight.color = glm::vec3(1.f, 0.9f, 0.7f);
+            headlight.cos_outer_cone = std::cos(glm::radians(25.f));
+            headlight.direction = direction;
+            headlight.padding = 0.f;
+            lights.push_back(headlight);
+        }
+    };
+    
+    JobGraph frame_graph;
+    size_t simulation_job = frame_graph.Add("Simulation", [&]()
+    {
+        for (int step = 0; step < simulation_steps; ++step)
+        {
+            previous_state = { player_pos, camera.Position };
+            enemies.SavePrevious();
+            simulate(float(simulation_clock.step_seconds));
+        }
+    });
+    
+    // Drawn part of the way from the previous step to the latest, the camera too while it follows the rover
+    size_t transforms_job = frame_graph.Add("Transforms", [&]()
+    {
+        float alpha = simulation_clock.Alpha();
+        player_translate = glm::translate(glm::mix(previous_state.player_pos, player_pos, alpha));
+        player_transform = player_translate * player_scaling * player_rotation;
+        enemy_transforms.resize(enemies.Count());
+        jobs.ParallelFor("Enemy transforms", enemies.Count(), 1024, [&](size_t begin, size_t end)
+        {
+            UpdateHeadings(enemies, begin, end);
+            for (size_t i = begin; i < end; ++i)
+                enemy_transforms[i] = glm::translate(enemies.InterpolatedPosition(i, alpha)) * enemy_scaling * glm::rotate(enemies.heading[i], glm::vec3(0,1,0));
+        });
+        
+        render_camera = camera;
+        if (goOn)
+            render_camera.Position = glm::mix(previous_state.camera_position, camera.Position, alpha);
+        
+        view = render_camera.GetViewMatrix();
+        projection = scene_framebuffer.Projection(glm::radians(render_camera.Zoom), aspect, near, far);
+        view_projection = projection * view;
+        
+        // Mars
+        auto mars_scale = glm::scale(glm::vec3(sphere_scale));
+        auto mars_translate = glm::translate(sphere_pos);
+        auto mars_rotate = glm::rotate(glm::radians(90.f), glm::vec3(1, 0.f, 0.f));
+        mars_transform = mars_translate * mars_scale * mars_rotate;
+    });
+    
+    // Alongside the draw list, Mars shrunk to stay inside the drawn sphere
+    size_t occlusion_job = frame_graph.Add("Occluder rasterization", [&]()
+    {
+        occlusion.occluders[mars_occluder].model = mars_transform * glm::scale(glm::vec3(0.999f));
+        occlusion.Rasterize(view_projection);
+    });
+    
+    /* Collect the frame's draws with their world-space bounds */
+    size_t draw_list_job = frame_graph.Add("Transform building", [&]()
+    {
+        draw_items.resize(1 + items_per_rover * (enemies.Count() + 1));
+        culling_set.Resize(draw_items.size());
+        submit(mars_item, "Mars", sphereVAO, planet_variant, planet_gbuffer_variant, mars_transform, sphere_bounds, glm::vec3(0), true);
+        submit_rover(1, player_transform, caught ? caught_color : player_color, moveForward && action, !moveForward && action);
+        jobs.ParallelFor("Enemy draws", enemies.Count(), 1024, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+                submit_rover(1 + items_per_rover * (i + 1), enemy_transforms[i], enemies.material[i] == ROVER_MATERIAL_WINNER ? winner_color : enemy_color,
+                    enemy_spin_forward, enemy_spin_backward);
+        });
+    });
+    
+    /* Enemy headlights are gathered in bands, one list each, and joined in enemy order. The distance test uses
+       the interpolated position the lights are placed at. */
+    std::vector<std::vector<ClusteredLight>> headlight_bands;
+    size_t headlights_job = frame_graph.Add("Headlights", [&]()
+    {
+        size_t band_count = enemies.Count() >= 4096 ? jobs.ThreadCount() * 4 : 1;
+        headlight_bands.resize(band_count);
+        jobs.ParallelFor("Headlight band", band_count, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t band = begin; band < end; ++band)
+            {
+                auto& lights = headlight_bands[band];
+                lights.clear();
+                for (size_t i = enemies.Count() * band / band_count; i < enemies.Count() * (band + 1) / band_count; ++i)
+                    if (glm::length(glm::vec3(enemy_transforms[i][3]) - render_camera.Position) < 100.f * player_scale)
+                        add_headlights(enemy_transforms[i], lights);
+            }
+        });
+        
+        clustered_lighting.lights.clear();
+        add_headlights(player_transform, clustered_lighting.lights);
+        for (const auto& lights : headlight_bands)
+            clustered_lighting.lights.insert(clustered_lighting.lights.end(), lights.begin(), lights.end());
+    });
+    
+    // Uploaded by the main thread once the graph is done
+    size_t light_binning_job = frame_graph.Add("Light binning", [&]()
+    {
+        clustered_lighting.Build(view, glm::radians(render_camera.Zoom), aspect, 2.f * player_scale, 4.f * sphere_scale);
+    });
+    
+    /* Drop everything outside the view frustum, on the far side of Mars or behind occluders before any GL work */
+    std::mutex culling_stats_mutex;
+    size_t culling_job = frame_graph.Add("Culling", [&]()
+    {
+        Globals.culling_stats = CullingStats();
+        FrustumPlanes planes = ExtractFrustumPlanes(view_projection);
+        jobs.ParallelFor("Culling band", culling_set.Count(), 4096, [&](size_t begin, size_t end)
+        {
+            CullingStats band = culling_set.CullFrustumAndHorizon(planes, render_camera.Position, { sphere_pos, sphere_scale }, begin, end);
+            std::lock_guard<std::mutex> lock(culling_stats_mutex);
+            Globals.culling_stats.tested += band.tested;
+            Globals.culling_stats.visible += band.visible;
+            Globals.culling_stats.frustum_culled += band.frustum_culled;
+            Globals.culling_stats.horizon_culled += band.horizon_culled;
+        });
+        culling_set.CullOccluded(occlusion.buffer, Globals.culling_stats);
+    });
+    
+    /* Everything is opaque, so front to back by bounding sphere center lets early depth testing reject the most */
+    size_t sort_job = frame_graph.Add("Sort draws", [&]()
+    {
+        draw_order.clear();
+        for (size_t i = 0; i < draw_items.size(); ++i)
+            if (culling_set.IsVisible(i))
+                draw_order.push_back(i);
+        
+        const auto view_distance = [&](size_t i) { return glm::length(glm::vec3(culling_set.x[i], culling_set.y[i], culling_set.z[i]) - render_camera.Position); };
+        std::sort(draw_order.begin(), draw_order.end(), [&](size_t a, size_t b) { return view_distance(a) < view_distance(b); });
+    });
+    
+    frame_graph.Depend(transforms_job, simulation_job);
+    frame_graph.Depend(draw_list_job, transforms_job);
+    frame_graph.Depend(occlusion_job, transforms_job);
+    frame_graph.Depend(headlights_job, transforms_job);
+    frame_graph.Depend(light_binning_job, headlights_job);
+    frame_graph.Depend(culling_job, draw_list_job);
+    frame_graph.Depend(culling_job, occlusion_job);
+    frame_graph.Depend(sort_job, culling_job);
+
+    /* Loop until the user closes the window */
+    while (running())
+    {
+        PROFILE_ZONE("Frame");
+        double frame_start = TimeSeconds();
+        
+        // What a live frame got from the last glfwPollEvents
+        if (Globals.input_mode == INPUT_MODE_REPLAY)
+            for (auto event = Globals.input.ReplayEventsBegin(); event != Globals.input.ReplayEventsEnd(); ++event)
+                DispatchInputEvent(window, *event);
+        
+        if (Globals.input_mode == INPUT_MODE_REPLAY)
+        {
+            Globals.deltaTime = replay_delta > 0.f ? replay_delta : Globals.input.ReplayDelta();
+            Globals.lastFrame += Globals.deltaTime;
+        }
+        else
+        {
+            float currentFrame = TimeSeconds();
+            Globals.deltaTime = currentFrame - Globals.lastFrame;
+            Globals.lastFrame = currentFrame;
+        }
+        
+        // Driving itself is simulated below, only what the frame shows and the free camera are handled here
+        PROFILE_BEGIN("Input");
+        key_up = KeyDown(window, GLFW_KEY_UP);
+        key_down = KeyDown(window, GLFW_KEY_DOWN);
+        key_left = KeyDown(window, GLFW_KEY_LEFT);
+        key_right = KeyDown(window, GLFW_KEY_RIGHT);
+        enemy_spin_forward = KeyDown(window, GLFW_KEY_W);
+        enemy_spin_backward = KeyDown(window, GLFW_KEY_S);
+        if(goOn == true){
+            if(key_up){
+                moveForward= true;
+                action= true;
+            }
+            if(key_down){
+                moveForward= false;
+                action= true;
+            }
+            if(KeyDown(window, GLFW_KEY_C)){
                 savedCamera = camera;
                 goOn = false;
-                glfwSetCursorPosCallback(window, CursorPositionCallback);
+                SetCursorPositionCallback(window, CursorPositionCallback);
             }
 
         }
         
         if(goOn == false){
             
-            if(glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS){
+            if(KeyDown(window, GLFW_KEY_V)){
                 goOn = true;
                 camera = savedCamera;
-                glfwSetCursorPosCallback(window, CursorPositionCallback_);
+                previous_state.camera_position = camera.Position;
+                SetCursorPositionCallback(window, CursorPositionCallback_);
             }
-            if(glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS){
+            if(key_up){
                 camera.ProcessKeyboard(FORWARD, Globals.deltaTime);
             }
-            if(glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS){
+            if(key_down){
                 camera.ProcessKeyboard(BACKWARD, Globals.deltaTime);
             }
-            if(glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS){
+            if(key_left){
                 camera.ProcessKeyboard(RIGHT, Globals.deltaTime);
             }
-            if(glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS){
+            if(key_right){
                 camera.ProcessKeyboard(LEFT, Globals.deltaTime);
             }
 
         }
-
-        float currentFrame = glfwGetTime();
-        Globals.deltaTime = currentFrame - Globals.lastFrame;
-        Globals.lastFrame = currentFrame;
+        PROFILE_END();
         
-        /* Render here */
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        simulation_steps = simulation_clock.Advance(Globals.deltaTime);
         
-
-        // Calculate mouse position
-        auto mouse_position = Globals.mouse_position;
-        mouse_position /= glm::dvec2(Globals.screen_dimensions);
-        mouse_position.y = 1. - mouse_position.y;
-        mouse_position = mouse_position * 2. - 1.;
-
-        glUniform2fv(mouse_location, 1, glm::value_ptr(glm::vec2(mouse_position)));
+        /* Move streamed texture data to the GPU, bounded per frame */
+        PROFILE_BEGIN("Texture streaming");
+        texture_streamer.Update();
+        if (use_virtual_texture)
+            virtual_texture.Update();
         
-//        auto camera_transform = glm::translate(glm::vec3(mouse_position,0));
-//        camera_transform = glm::inverse(camera_transform);
+        if (!use_virtual_texture && !texture_1_registered)
+            texture_1_registered = register_texture_1();
+        PROFILE_END();
         
-        auto view = camera.GetViewMatrix();
-    
-//        auto projection = glm::ortho(-5.f,5.f,-1.f,1.f,-1.f,1.f);
-
-        
-        auto projection = glm::perspective(glm::radians(camera.Zoom), aspect, near, far);
-        
-        auto view_projection = projection * view;//        glm::perspective(1,1,1,1);
-
-        // Draw Mars
-        glBindVertexArray(sphereVAO.id);
-
-        auto mars_scale = glm::scale(glm::vec3(sphere_scale));
-        auto mars_translate = glm::translate(sphere_pos);
-        auto mars_rotate = glm::rotate(glm::radians(90.f), glm::vec3(1, 0.f, 0.f));
-        auto mars_transform = mars_translate * mars_scale * mars_rotate;
+        /* Render here */
+        gpu_profiler.BeginFrame();
+        gpu_profiler.BeginScope("Frame");
         
-        glUniformMatrix4fv(projection_view_location, 1, GL_FALSE, glm::value_ptr(view_projection));
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, glm::value_ptr(mars_transform));
-        glUniform1f(material_location,2);
-        glDrawElements(GL_TRIANGLES, sphereVAO.element_array_count, GL_UNSIGNED_INT, NULL);
+        glm::ivec2 render_size = Globals.render_size.x > 0 ? Globals.render_size : Globals.screen_dimensions;
+        scene_framebuffer.Begin(render_size.x, render_size.y);
+        current_variant = NULL;
         
-        //Draw Rover
+        /* Simulation up to the sorted draw list and binned lights, the main thread runs jobs as well until the graph is done */
+        jobs.TakeUtilization();
+        jobs.Run(frame_graph);
+        float job_utilization = jobs.TakeUtilization();
+        PROFILE_COUNTER("Job utilization", job_utilization * 100.0);
+        job_utilization_sum += job_utilization;
+        job_utilization_run_sum += job_utilization;
+        job_utilization_frames++;
         
-        glBindVertexArray(cubeVAO.id);
+        // One texel spans the equator divided by the texture width, seen from the nearest point of the surface
+        PROFILE_BEGIN("Texture residency");
+        texture_residency.BeginFrame();
+        for (const auto& entry : texture_residency.textures)
+            if (entry.texture == texture_1)
+                texture_residency.RecordUse(texture_1, 2.f * glm::pi<float>() * sphere_scale / entry.width,
+                    std::max(glm::length(render_camera.Position - sphere_pos) - sphere_scale, near),
+                    glm::radians(render_camera.Zoom), render_size.y);
+        texture_residency.Update();
+        PROFILE_END();
         
-        glUniformMatrix4fv(projection_view_location, 1, GL_FALSE, glm::value_ptr(view_projection));
-        glUniformMatrix4fv(model_location,1,GL_FALSE, glm::value_ptr(player_transform));
+        PROFILE_BEGIN("Light upload");
+        clustered_lighting.Upload(render_size.x, render_size.y);
+        PROFILE_END();
         
-        if(CheckCollision(player_pos, enemy_1_pos) || CheckCollision(player_pos, enemy_2_pos)){
-            glUniform1f(material_location, 3);
-            glfwSetCursorPosCallback(window, CursorPositionCallback);
-            goOn = false;
-            collision = true;
-        }
-        else
+        // Low resolution pass telling the virtual texture which pages Mars needs, read back a few frames later
+        if (use_virtual_texture && culling_set.IsVisible(mars_item))
         {
-            glUniform1f(material_location, 1);
+            begin_pass("Virtual texture feedback");
+            glBindVertexArray(sphereVAO.id);
+            virtual_texture.BeginFeedback(render_size.x, render_size.y);
+            use_variant(feedback_variant);
+            glUniformMatrix4fv(feedback_variant->model_location, 1, GL_FALSE, glm::value_ptr(mars_transform));
+            glDrawElements(GL_TRIANGLES, sphereVAO.element_array_count, GL_UNSIGNED_INT, NULL);
+            virtual_texture.EndFeedback();
+            end_pass();
         }
-        glDrawElements(GL_TRIANGLES, cubeVAO.element_array_count, GL_UNSIGNED_INT, NULL);
-        
-        //Draw tiers
-//
-        glBindVertexArray(torusVAO.id);
-
-        const auto draw_tire = [&](glm::vec3 position)
+        const VAO * bound_vao = NULL;
+        const auto draw = [&](const DrawItem& item, const ShaderVariant * variant)
         {
-            auto tire_scaling = glm::scale(glm::vec3(0.3));
-            auto tire_translate = glm::translate(glm::vec3(position));
-            auto tire_transform = player_transform * tire_translate * tire_scaling * glm::rotate(glm::radians(90.f), glm::vec3(0,0,1));
-
-            if (moveForward && action) {
-                tire_transform *= glm::rotate(glm::radians(float(glfwGetTime()) *1000.f), glm::vec3(0,1,0));
-            }
-            if (!moveForward && action) {
-                tire_transform *= glm::rotate(glm::radians(float(glfwGetTime()) *1000.f), glm::vec3(0,-1,0));
+            if (item.vao != bound_vao)
+            {
+                bound_vao = item.vao;
+                glBindVertexArray(bound_vao->id);
             }
-            
-            glUniformMatrix4fv(model_location,1,GL_FALSE, glm::value_ptr(tire_transform));
-            glUniform1f(material_location, 3);
-            glDrawElements(GL_TRIANGLES, torusVAO.element_array_count, GL_UNSIGNED_INT, NULL);
-            
+            use_variant(variant);
+            glUniformMatrix4fv(variant->model_location, 1, GL_FALSE, glm::value_ptr(item.model));
+            if (variant->color_location >= 0)
+                glUniform3fv(variant->color_location, 1, glm::value_ptr(item.color));
+            glDrawElements(GL_TRIANGLES, bound_vao->element_array_count, GL_UNSIGNED_INT, NULL);
         };
         
-        std::vector<glm::vec3> tire_positions{
-            glm::vec3(0.58,-0.5,0.5),
-            glm::vec3(0.58,-0.5,-0.5),
-            glm::vec3(-0.58,-0.5,0.5),
-            glm::vec3(-0.58,-0.5,-0.5)
+        // Consecutive draws of the same group share one profiler scope, NULL closes the open one
+        const char * timed_group = NULL;
+        const auto time_group = [&](const char * group)
+        {
+            if (group == timed_group)
+                return;
+            if (timed_group != NULL)
+                end_pass();
+            timed_group = group;
+            if (group != NULL)
+                begin_pass(group);
         };
         
-        for (const auto& p : tire_positions){
-            draw_tire(p);
-        }
-        
-
-        glBindVertexArray(cubeVAO.id);
+        // Shadow casters are not culled against the camera, rovers outside the view still cast into it
+        shadow_maps.Update(render_camera.Position, render_camera.Front, render_camera.Up, glm::radians(render_camera.Zoom), aspect,
+            2.f * player_scale, 4.f * sphere_scale, light_direction);
+        begin_pass("Shadow maps");
+        shadow_maps.Render([&](const glm::mat4& light_projection_view, bool static_only)
+        {
+            glUseProgram(depth_variant->program);
+            glUniformMatrix4fv(depth_variant->projection_view_location, 1, GL_FALSE, glm::value_ptr(light_projection_view));
+            for (const auto& item : draw_items)
+            {
+                if (static_only && !item.is_static)
+                    continue;
+                if (item.vao != bound_vao)
+                {
+                    bound_vao = item.vao;
+                    glBindVertexArray(bound_vao->id);
+                }
+                glUniformMatrix4fv(depth_variant->model_location, 1, GL_FALSE, glm::value_ptr(item.model));
+                glDrawElements(GL_TRIANGLES, bound_vao->element_array_count, GL_UNSIGNED_INT, NULL);
+            }
+        });
+        end_pass();
+        current_variant = NULL;
         
-        if (!collision){
-            glm::dvec2 chasing_pos;
-            chasing_pos = glm::mix(glm::dvec2(player_pos.x, player_pos.z), glm::dvec2(enemy_1_pos.x, enemy_1_pos.z), 0.999);
-            enemy_1_pos = glm::vec3(chasing_pos.x, enemy_1_pos.y, chasing_pos.y);
-            enemy1_saved_pos = enemy_1_pos;
+        size_t query_slot = shading_frame % shading_query_count;
+        GLint query_available = 0;
+        if (shading_query_issued[query_slot])
+            glGetQueryObjectiv(shading_queries[query_slot], GL_QUERY_RESULT_AVAILABLE, &query_available);
+        if (query_available)
+        {
+            GLuint64 samples;
+            glGetQueryObjectui64v(shading_queries[query_slot], GL_QUERY_RESULT, &samples);
+            shading_samples_sum += samples;
+            shading_samples_frames++;
         }
         
-        else if (collision){
-            enemy_1_pos = enemy1_saved_pos;
-        }
-        enemy_1_translate = glm::translate(enemy_1_pos);
-        auto transform_1 = enemy_1_translate * enemy_1_scaling * enemy_1_rotation;
-        
-                    
-        glUniformMatrix4fv(projection_view_location, 1, GL_FALSE, glm::value_ptr(view_projection));
-        glUniformMatrix4fv(model_location,1,GL_FALSE, glm::value_ptr(transform_1));
-        if (!collision){
-            glUniform1f(material_location, 4);
-        }
-        else if(collision){
-            glUniform1f(material_location, 5);
+        if (Globals.deferred)
+        {
+            // Geometry into the G-buffer, then one full-screen pass lights it into the scene framebuffer
+            begin_pass("G-buffer");
+            deferred_shading.BeginGeometry(render_size.x, render_size.y);
+            for (auto i : draw_order)
+            {
+                time_group(draw_items[i].gpu_scope);
+                draw(draw_items[i], draw_items[i].gbuffer_variant);
+            }
+            time_group(NULL);
+            deferred_shading.EndGeometry();
+            end_pass();
+            
+            begin_pass("Lighting");
+            glBeginQuery(GL_SAMPLES_PASSED, shading_queries[query_slot]);
+            use_variant(lighting_variant);
+            deferred_shading.Light(view_projection, scene_framebuffer.mode == DEPTH_MODE_REVERSED_Z);
+            glEndQuery(GL_SAMPLES_PASSED);
+            bound_vao = NULL;
+            end_pass();
         }
-        glDrawElements(GL_TRIANGLES, cubeVAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                    
-                    //Draw tiers
-            //
-        glBindVertexArray(torusVAO.id);
-
-        const auto draw_tire_enemy = [&](glm::vec3 position)
+        else
         {
-            auto tire_scaling = glm::scale(glm::vec3(0.3));
-            auto tire_translate = glm::translate(glm::vec3(position));
-            auto tire_transform = transform_1 * tire_translate * tire_scaling * glm::rotate(glm::radians(90.f), glm::vec3(0,0,1));
-
-            if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-                tire_transform *= glm::rotate(glm::radians(float(glfwGetTime()) *1000.f), glm::vec3(0,1,0));
+            // Depth only first, then every pixel is shaded exactly once by the fragment that won
+            if (Globals.z_prepass)
+            {
+                begin_pass("Z-prepass");
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                for (auto i : draw_order)
+                    draw(draw_items[i], depth_variant);
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                glDepthMask(GL_FALSE);
+                glDepthFunc(GL_EQUAL);
+                end_pass();
             }
-            if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-                tire_transform *= glm::rotate(glm::radians(float(glfwGetTime()) *1000.f), glm::vec3(0,-1,0));
+            
+            begin_pass("Shading");
+            glBeginQuery(GL_SAMPLES_PASSED, shading_queries[query_slot]);
+            for (auto i : draw_order)
+            {
+                time_group(draw_items[i].gpu_scope);
+                draw(draw_items[i], draw_items[i].variant);
+            }
+            time_group(NULL);
+            glEndQuery(GL_SAMPLES_PASSED);
+            end_pass();
+            
+            if (Globals.z_prepass)
+            {
+                glDepthMask(GL_TRUE);
+                glDepthFunc(scene_framebuffer.DepthCompare());
             }
-                        
-            glUniformMatrix4fv(model_location,1,GL_FALSE, glm::value_ptr(tire_transform));
-            glUniform1f(material_location, 3);
-            glDrawElements(GL_TRIANGLES, torusVAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                        
-        };
-                    
-        std::vector<glm::vec3> enemy_tire_positions_2{
-            glm::vec3(0.58,-0.5,0.5),
-            glm::vec3(0.58,-0.5,-0.5),
-            glm::vec3(-0.58,-0.5,0.5),
-            glm::vec3(-0.58,-0.5,-0.5)
-        };
-                    
-        for (const auto& p : enemy_tire_positions_2){
-            draw_tire_enemy(p);
         }
         
-        glBindVertexArray(cubeVAO.id);
+        shading_query_issued[query_slot] = true;
+        shading_frame++;
         
-        if (!collision){
-            glm::dvec2 chasing_pos_2;
-            chasing_pos_2 = glm::mix(glm::dvec2(player_pos.x, player_pos.z), glm::dvec2(enemy_2_pos.x, enemy_2_pos.z), 0.999);
-            enemy_2_pos = glm::vec3(chasing_pos_2.x, enemy_2_pos.y, chasing_pos_2.y);
-            enemy2_saved_pos = enemy_2_pos;
-        }
-        
-        else if (collision){
-            enemy_2_pos = enemy2_saved_pos;
-        }
+        scene_framebuffer.End(Globals.screen_dimensions.x, Globals.screen_dimensions.y);
+        gpu_profiler.EndScope();
+        gpu_profiler.EndFrame();
         
-        enemy_2_translate = glm::translate(enemy_2_pos);
-        auto transform_2 = enemy_2_translate * enemy_2_scaling * enemy_2_rotation;
-                    
-        glUniformMatrix4fv(projection_view_location, 1, GL_FALSE, glm::value_ptr(view_projection));
-        glUniformMatrix4fv(model_location,1,GL_FALSE, glm::value_ptr(transform_2));
-        if (!collision){
-            glUniform1f(material_location, 4);
-        }
-        else if(collision){
-            glUniform1f(material_location, 5);
-        }
-        glDrawElements(GL_TRIANGLES, cubeVAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                    
-                    //Draw tiers
-            //
-        glBindVertexArray(torusVAO.id);
-
-        const auto draw_tire_enemy2 = [&](glm::vec3 position)
+        if (TimeSeconds() - shading_report_time > 5.0 && shading_samples_frames > 0)
         {
-            auto tire_scaling = glm::scale(glm::vec3(0.3));
-            auto tire_translate = glm::translate(glm::vec3(position));
-            auto tire_transform = transform_2 * tire_translate * tire_scaling * glm::rotate(glm::radians(90.f), glm::vec3(0,0,1));
-
-            if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-                tire_transform *= glm::rotate(glm::radians(float(glfwGetTime()) *1000.f), glm::vec3(0,1,0));
-            }
-            if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-                tire_transform *= glm::rotate(glm::radians(float(glfwGetTime()) *1000.f), glm::vec3(0,-1,0));
-            }
-                        
-            glUniformMatrix4fv(model_location,1,GL_FALSE, glm::value_ptr(tire_transform));
-            glUniform1f(material_location, 3);
-            glDrawElements(GL_TRIANGLES, torusVAO.element_array_count, GL_UNSIGNED_INT, NULL);
-                        
-        };
-                    
-        std::vector<glm::vec3> enemy_tire_positions_3{
-            glm::vec3(0.58,-0.5,0.5),
-            glm::vec3(0.58,-0.5,-0.5),
-            glm::vec3(-0.58,-0.5,0.5),
-            glm::vec3(-0.58,-0.5,-0.5)
-        };
-                    
-        for (const auto& p : enemy_tire_positions_3){
-            draw_tire_enemy2(p);
+            std::cout << "Shaded samples per frame: " << shading_samples_sum / shading_samples_frames << " (" << (Globals.deferred ? "deferred" : "forward")
+                << ", Z-prepass " << (Globals.z_prepass && !Globals.deferred ? "on" : "off") << ", " << render_size.x << "x" << render_size.y << ")" << std::endl;
+            gpu_profiler.Print(std::cout);
+            std::cout << "Job threads busy during the frame graph: " << 100.0 * job_utilization_sum / std::max(job_utilization_frames, 1u)
+                << "% of " << jobs.ThreadCount() << std::endl;
+            job_utilization_sum = 0.0;
+            job_utilization_frames = 0;
+            shading_samples_sum = 0;
+            shading_samples_frames = 0;
+            shading_report_time = TimeSeconds();
         }
         
         moveForward = false;
         action= false;
 
-        /* Swap front and back buffers */
-        glfwSwapBuffers(window);
+        cpu_times.Add(TimeSeconds() - frame_start);
+        
+        /* Swap front and back buffers, headless waits for the GPU instead so frame times include its work */
+        PROFILE_BEGIN("Swap buffers");
+        if (Globals.headless)
+            glFinish();
+        else
+            glfwSwapBuffers(window);
+        PROFILE_END();
 
-        /* Poll for and process events */
-        glfwPollEvents();
+        /* Poll for and process events, what arrives now belongs to the next recorded frame */
+        if (Globals.input_mode == INPUT_MODE_RECORD)
+            Globals.input.EndRecordedFrame(Globals.deltaTime);
+        else if (Globals.input_mode == INPUT_MODE_REPLAY)
+            Globals.input.NextReplayFrame();
+        if (!Globals.headless)
+            glfwPollEvents();
+        
+        frame_times.Add(TimeSeconds() - frame_start);
+        frames_rendered++;
+    }
+    
+    if (Globals.headless || Globals.input_mode == INPUT_MODE_REPLAY)
+    {
+        glm::ivec2 render_size = Globals.render_size.x > 0 ? Globals.render_size : Globals.screen_dimensions;
+        std::cout << (Globals.deferred ? "Deferred" : "Forward") << " shading at " << render_size.x << "x" << render_size.y << std::endl;
+        frame_times.Print(std::cout);
+        cpu_times.Print(std::cout);
+        gpu_profiler.Print(std::cout);
+        std::cout << "Job threads busy during the frame graph: " << 100.0 * job_utilization_run_sum / std::max(frames_rendered, 1)
+            << "% of " << jobs.ThreadCount() << std::endl;
+    }
+    
+    if (Globals.input_mode == INPUT_MODE_RECORD)
+    {
+        if (Globals.input.Write(record_path))
+            std::cout << "Recorded " << Globals.input.frames.size() << " frames to " << record_path << std::endl;
+    }
+    
+    if (cpu_trace_path != NULL)
+        CpuProfiler::WriteChromeTrace(cpu_trace_path);
+    
+    if (gpu_profile_path != NULL)
+    {
+        std::string path = gpu_profile_path;
+        if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+            gpu_profiler.WriteJson(path);
+        else
+            gpu_profiler.WriteCsv(path);
     }
 
+    headless_context.Destroy();
     glfwTerminate();
     return 0;
 }
@@ -52,6 +52,17 @@ GLuint CreateShaderFromSource(const GLenum& shader_type, const GLchar * source)
 	glShaderSource(shader, 1, &source, NULL);
 	glCompileShader(shader);
 
+	if (!ShaderCompiled(shader))
+	{
+		glDeleteShader(shader);
+		return NULL;
+	}
+
+	return shader;
+}
+
+bool ShaderCompiled(GLuint shader)
+{
 	int success;
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
 	if (!success)
@@ -61,27 +72,13 @@ GLuint CreateShaderFromSource(const GLenum& shader_type, const GLchar * source)
 		char info_log[512];
 		glGetShaderInfoLog(shader, 512, NULL, info_log);
 		std::cout << info_log << std::endl;
-
-		glDeleteShader(shader);
-		return NULL;
 	}
 
-	return shader;
+	return success;
 }
 
-GLuint CreateProgramFromSources(const GLchar * vertex_shader_source, const GLchar * fragment_shader_source)
+bool ProgramLinked(GLuint program)
 {
-	GLuint vertex_shader = CreateShaderFromSource(GL_VERTEX_SHADER, vertex_shader_source);
-	GLuint fragment_shader = CreateShaderFromSource(GL_FRAGMENT_SHADER, fragment_shader_source);
-
-	if (vertex_shader == NULL || fragment_shader == NULL)
-		return NULL;
-
-	GLuint program = glCreateProgram();
-	glAttachShader(program, vertex_shader);
-	glAttachShader(program, fragment_shader);
-	glLinkProgram(program);
-
 	int success;
 	glGetProgramiv(program, GL_LINK_STATUS, &success);
 	if (!success)
@@ -91,10 +88,68 @@ GLuint CreateProgramFromSources(const GLchar * vertex_shader_source, const GLcha
 		char info_log[512];
 		glGetProgramInfoLog(program, 512, NULL, info_log);
 		std::cout << info_log << std::endl;
+	}
+
+	return success;
+}
+
+GLuint LinkProgram(GLuint vertex_shader, GLuint fragment_shader, bool retrievable_binary)
+{
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertex_shader);
+	glAttachShader(program, fragment_shader);
+
+	// Some drivers only keep a binary around for glGetProgramBinary when asked before linking
+	if (retrievable_binary)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
+	glLinkProgram(program);
+
+	if (!ProgramLinked(program))
+	{
 		glDeleteProgram(program);
 		return NULL;
 	}
 
 	return program;
 }
+
+GLuint CreateProgramFromSources(const GLchar * vertex_shader_source, const GLchar * fragment_shader_source)
+{
+	GLuint vertex_shader = CreateShaderFromSource(GL_VERTEX_SHADER, vertex_shader_source);
+	GLuint fragment_shader = CreateShaderFromSource(GL_FRAGMENT_SHADER, fragment_shader_source);
+
+	if (vertex_shader == NULL || fragment_shader == NULL)
+		return NULL;
+
+	return LinkProgram(vertex_shader, fragment_shader);
+}
+
+GLuint CreateProgramFromSources(const GLchar * vertex_shader_source, const GLchar * fragment_shader_source, const std::string& defines)
+{
+	auto vertex_source = InjectShaderDefines(vertex_shader_source, defines);
+	auto fragment_source = InjectShaderDefines(fragment_shader_source, defines);
+
+	return CreateProgramFromSources(vertex_source.c_str(), fragment_source.c_str());
+}
+
+std::string InjectShaderDefines(const GLchar * source, const std::string& defines)
+{
+	std::string result(source);
+
+	// #version has to stay the first directive, so the defines go on the line after it
+	auto version = result.find("#version");
+	auto insert_at = version == std::string::npos ? 0 : result.find('\n', version);
+	if (insert_at == std::string::npos)
+	{
+		result += '\n';
+		insert_at = result.size();
+	}
+	else if (version != std::string::npos)
+	{
+		insert_at += 1;
+	}
+
+	result.insert(insert_at, defines);
+	return result;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include "glad/glad.h"
@@ -32,5 +33,16 @@ struct VAO
 
 GLuint CreateShaderFromSource(const GLenum& shader_type, const GLchar * source);
 
+// Query GL_COMPILE_STATUS / GL_LINK_STATUS and print the info log on failure. Blocks until the driver is done.
+bool ShaderCompiled(GLuint shader);
+bool ProgramLinked(GLuint program);
+
+GLuint LinkProgram(GLuint vertex_shader, GLuint fragment_shader, bool retrievable_binary = false);
+
 GLuint CreateProgramFromSources(const GLchar * vertex_shader_source, const GLchar * fragment_shader_source);
 
+// Same as above, but "defines" is inserted right after the #version line of both stages
+GLuint CreateProgramFromSources(const GLchar * vertex_shader_source, const GLchar * fragment_shader_source, const std::string& defines);
+
+std::string InjectShaderDefines(const GLchar * source, const std::string& defines);
+
@@ -0,0 +1,143 @@
+#include "program_builder.h"
+
+#include <iomanip>
+
+/* Asynchronous Program Builder */
+
+AsyncProgramBuilder::AsyncProgramBuilder(ProgramBinaryCache * binary_cache)
+	: binary_cache(binary_cache), total_milliseconds(0), cache_hits(0), cache_misses(0)
+{
+	parallel_compile = GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile;
+
+	// 0xFFFFFFFF lets the driver pick as many compiler threads as it sees fit
+	if (GLAD_GL_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	else if (GLAD_GL_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+	std::cout << "Parallel shader compilation " << (parallel_compile ? "enabled" : "not available") << std::endl;
+}
+
+size_t AsyncProgramBuilder::Submit(const std::string& vertex_shader_source, const std::string& fragment_shader_source)
+{
+	AsyncProgram entry;
+	entry.source_hash = HashProgramSources(vertex_shader_source, fragment_shader_source);
+	entry.vertex_shader = NULL;
+	entry.fragment_shader = NULL;
+	entry.program = NULL;
+	entry.linked = false;
+	entry.resolved = false;
+	entry.from_cache = false;
+	entry.submitted = std::chrono::steady_clock::now();
+
+	if (binary_cache != NULL && binary_cache->supported)
+		entry.program = binary_cache->Load(entry.source_hash);
+
+	if (entry.program != NULL)
+	{
+		entry.linked = true;
+		entry.from_cache = true;
+	}
+	else
+	{
+		const GLchar * vertex_source = vertex_shader_source.c_str();
+		entry.vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(entry.vertex_shader, 1, &vertex_source, NULL);
+		glCompileShader(entry.vertex_shader);
+
+		const GLchar * fragment_source = fragment_shader_source.c_str();
+		entry.fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(entry.fragment_shader, 1, &fragment_source, NULL);
+		glCompileShader(entry.fragment_shader);
+	}
+
+	programs.push_back(entry);
+	return programs.size() - 1;
+}
+
+void AsyncProgramBuilder::LinkAll()
+{
+	for (auto& entry : programs)
+	{
+		if (entry.linked)
+			continue;
+
+		entry.program = glCreateProgram();
+		glAttachShader(entry.program, entry.vertex_shader);
+		glAttachShader(entry.program, entry.fragment_shader);
+		if (binary_cache != NULL && binary_cache->supported)
+			glProgramParameteri(entry.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(entry.program);
+
+		entry.linked = true;
+	}
+}
+
+bool AsyncProgramBuilder::IsReady(size_t handle)
+{
+	auto& entry = programs[handle];
+	if (entry.resolved || entry.from_cache)
+		return true;
+	if (!entry.linked)
+		return false;
+
+	// Without the extension there is no way to ask, so the program counts as ready and Resolve may block
+	if (!parallel_compile)
+		return true;
+
+	int completed;
+	glGetProgramiv(entry.program, GL_COMPLETION_STATUS_KHR, &completed);
+	return completed;
+}
+
+GLuint AsyncProgramBuilder::Resolve(size_t handle)
+{
+	auto& entry = programs[handle];
+	if (entry.resolved)
+		return entry.program;
+
+	if (!entry.linked)
+		LinkAll();
+
+	auto blocking_start = std::chrono::steady_clock::now();
+	bool ready = IsReady(handle);
+
+	bool success = entry.from_cache;
+	if (!entry.from_cache)
+	{
+		// A failed link is usually a failed compile, the shader logs say why
+		success = ProgramLinked(entry.program);
+		if (!success)
+		{
+			ShaderCompiled(entry.vertex_shader);
+			ShaderCompiled(entry.fragment_shader);
+			glDeleteProgram(entry.program);
+			entry.program = NULL;
+		}
+
+		// The program keeps what it needs, the shader objects can go once linked
+		glDeleteShader(entry.vertex_shader);
+		glDeleteShader(entry.fragment_shader);
+
+		if (success && binary_cache != NULL && binary_cache->supported)
+			binary_cache->Store(entry.source_hash, entry.program);
+	}
+
+	entry.resolved = true;
+
+	auto now = std::chrono::steady_clock::now();
+	auto milliseconds = std::chrono::duration<double, std::milli>(now - entry.submitted).count();
+	auto blocked_milliseconds = std::chrono::duration<double, std::milli>(now - blocking_start).count();
+	total_milliseconds += blocked_milliseconds;
+	(entry.from_cache ? cache_hits : cache_misses)++;
+
+	std::cout << "Program " << std::hex << entry.source_hash << std::dec
+		<< (entry.from_cache ? " loaded from binary cache" : " compiled from source")
+		<< std::fixed << std::setprecision(2)
+		<< ", ready " << milliseconds << " ms after submit"
+		<< ", blocked " << blocked_milliseconds << " ms" << (ready ? "" : " (not finished in the background)")
+		<< " [total blocked " << total_milliseconds << " ms, " << cache_hits << " cached, " << cache_misses << " compiled]"
+		<< std::defaultfloat << std::endl;
+
+	return entry.program;
+}
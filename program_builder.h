@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "opengl_utilities.h"
+#include "program_cache.h"
+
+/* Asynchronous Program Builder */
+
+struct AsyncProgram
+{
+	uint64_t source_hash;
+
+	GLuint vertex_shader;
+	GLuint fragment_shader;
+	GLuint program;
+
+	bool linked;
+	bool resolved;
+	bool from_cache;
+
+	std::chrono::steady_clock::time_point submitted;
+};
+
+// Compiles and links programs without asking the driver for their status until they are needed.
+// glCompileShader / glLinkProgram return immediately on most drivers as long as nobody queries
+// GL_COMPILE_STATUS, and with KHR_parallel_shader_compile the work is spread over driver threads.
+struct AsyncProgramBuilder
+{
+	// Optional, every program is compiled from source without it
+	ProgramBinaryCache * binary_cache;
+	bool parallel_compile;
+
+	std::vector<AsyncProgram> programs;
+
+	double total_milliseconds;
+	int cache_hits;
+	int cache_misses;
+
+	AsyncProgramBuilder(ProgramBinaryCache * binary_cache = NULL);
+
+	// Starts compiling both stages and returns a handle for IsReady / Resolve
+	size_t Submit(const std::string& vertex_shader_source, const std::string& fragment_shader_source);
+
+	// Issues glLinkProgram for everything submitted so far
+	void LinkAll();
+
+	// Never blocks: true once the program can be resolved without waiting
+	bool IsReady(size_t handle);
+
+	// Blocks until the program is linked, checks for errors and returns it (NULL on failure)
+	GLuint Resolve(size_t handle);
+};
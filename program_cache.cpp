@@ -0,0 +1,164 @@
+#include "program_cache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+/* Cache File Layout */
+
+namespace
+{
+	const uint32_t cache_magic = 0x4350424D; // "MBPC"
+	const uint32_t cache_version = 1;
+
+	struct CacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t driver_hash;
+		uint64_t source_hash;
+		uint32_t binary_format;
+		uint32_t binary_length;
+	};
+
+	std::string GLString(GLenum name)
+	{
+		auto value = glGetString(name);
+		return value ? reinterpret_cast<const char *>(value) : "";
+	}
+}
+
+/* Program Binary Cache */
+
+ProgramBinaryCache::ProgramBinaryCache(const std::string& directory)
+	: directory(directory)
+{
+	driver_id = GLString(GL_VENDOR) + "|" + GLString(GL_RENDERER) + "|" + GLString(GL_VERSION);
+	driver_hash = HashFNV1a(driver_id);
+
+	GLint format_count = 0;
+	if (GLAD_GL_ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+	supported = format_count > 0;
+
+	if (!supported)
+	{
+		std::cout << "Program binary cache disabled: driver reports no binary formats" << std::endl;
+		return;
+	}
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	if (error)
+	{
+		std::cout << "Error: Could not create program cache directory " << directory << ": " << error.message() << std::endl;
+		supported = false;
+	}
+}
+
+GLuint ProgramBinaryCache::Load(uint64_t source_hash)
+{
+	std::ifstream file(EntryPath(source_hash), std::ios::binary);
+	if (!file)
+		return NULL;
+
+	CacheHeader header;
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+		return NULL;
+
+	if (header.magic != cache_magic || header.version != cache_version ||
+		header.driver_hash != driver_hash || header.source_hash != source_hash)
+	{
+		std::cout << "Program cache entry " << std::hex << source_hash << std::dec << " is stale, recompiling" << std::endl;
+		return NULL;
+	}
+
+	std::vector<char> binary(header.binary_length);
+	if (!file.read(binary.data(), binary.size()))
+		return NULL;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header.binary_format, binary.data(), GLsizei(binary.size()));
+
+	// Drivers are free to reject binaries (e.g. after an update that kept the version string)
+	int success;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		std::cout << "Program cache entry " << std::hex << source_hash << std::dec << " was rejected by the driver, recompiling" << std::endl;
+		glDeleteProgram(program);
+		return NULL;
+	}
+
+	return program;
+}
+
+void ProgramBinaryCache::Store(uint64_t source_hash, GLuint program)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> binary(length);
+	GLenum binary_format;
+	glGetProgramBinary(program, length, NULL, &binary_format, binary.data());
+
+	CacheHeader header;
+	header.magic = cache_magic;
+	header.version = cache_version;
+	header.driver_hash = driver_hash;
+	header.source_hash = source_hash;
+	header.binary_format = binary_format;
+	header.binary_length = uint32_t(length);
+
+	// Write to a temporary file first so a crash never leaves a truncated entry behind
+	auto path = EntryPath(source_hash);
+	auto temporary_path = path + ".tmp";
+	{
+		std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		file.write(binary.data(), binary.size());
+		if (!file)
+		{
+			std::cout << "Error: Could not write program cache entry " << temporary_path << std::endl;
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporary_path, path, error);
+	if (error)
+		std::cout << "Error: Could not write program cache entry " << path << ": " << error.message() << std::endl;
+}
+
+std::string ProgramBinaryCache::EntryPath(uint64_t source_hash) const
+{
+	std::ostringstream name;
+	name << std::hex << std::setw(16) << std::setfill('0') << source_hash << ".bin";
+	return (std::filesystem::path(directory) / name.str()).string();
+}
+
+/* Hash Functions */
+
+uint64_t HashFNV1a(const void * data, size_t size, uint64_t hash)
+{
+	auto bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t HashFNV1a(const std::string& text, uint64_t hash)
+{
+	return HashFNV1a(text.data(), text.size(), hash);
+}
+
+uint64_t HashProgramSources(const std::string& vertex_shader_source, const std::string& fragment_shader_source)
+{
+	return HashFNV1a(fragment_shader_source, HashFNV1a(vertex_shader_source));
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "opengl_utilities.h"
+
+/* Program Binary Cache */
+
+// Keeps linked programs on disk via glGetProgramBinary / glProgramBinary.
+// A cached binary is only used if both the sources and the driver (vendor, renderer, version) match,
+// anything else falls back to compiling from source and refreshes the cache entry.
+struct ProgramBinaryCache
+{
+	std::string directory;
+	std::string driver_id;
+	uint64_t driver_hash;
+	bool supported;
+
+	// Needs a current GL context, the driver id is read from glGetString
+	ProgramBinaryCache(const std::string& directory);
+
+	// Returns NULL when there is no usable entry for "source_hash"
+	GLuint Load(uint64_t source_hash);
+	void Store(uint64_t source_hash, GLuint program);
+
+	std::string EntryPath(uint64_t source_hash) const;
+};
+
+/* Hash Functions */
+
+uint64_t HashFNV1a(const void * data, size_t size, uint64_t hash = 14695981039346656037ull);
+uint64_t HashFNV1a(const std::string& text, uint64_t hash = 14695981039346656037ull);
+uint64_t HashProgramSources(const std::string& vertex_shader_source, const std::string& fragment_shader_source);
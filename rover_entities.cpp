@@ -0,0 +1,256 @@
+#include "rover_entities.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/* Rover Entities */
+
+RoverEntities::RoverEntities()
+	: first_free_slot(UINT32_MAX)
+{
+}
+
+RoverHandle RoverEntities::Spawn(const glm::vec3& position, RoverMaterial rover_material, RoverAiState rover_ai_state)
+{
+	uint32_t rover_slot = first_free_slot;
+	if (rover_slot != UINT32_MAX)
+		first_free_slot = slot_rover[rover_slot];
+	else
+	{
+		rover_slot = uint32_t(slot_rover.size());
+		slot_rover.push_back(0);
+		slot_generation.push_back(0);
+	}
+	slot_rover[rover_slot] = uint32_t(Count());
+
+	x.push_back(position.x);
+	y.push_back(position.y);
+	z.push_back(position.z);
+	previous_x.push_back(position.x);
+	previous_y.push_back(position.y);
+	previous_z.push_back(position.z);
+	velocity_x.push_back(0.f);
+	velocity_z.push_back(0.f);
+	heading.push_back(0.f);
+	material.push_back(rover_material);
+	ai_state.push_back(rover_ai_state);
+	slot.push_back(rover_slot);
+
+	return { rover_slot, slot_generation[rover_slot] };
+}
+
+bool RoverEntities::Despawn(RoverHandle handle)
+{
+	if (!IsAlive(handle))
+		return false;
+
+	// The last rover fills the hole, its slot now points at the new index
+	size_t index = slot_rover[handle.slot];
+	size_t last = Count() - 1;
+	const auto move_last = [&](auto& component)
+	{
+		component[index] = component[last];
+		component.pop_back();
+	};
+	move_last(x);
+	move_last(y);
+	move_last(z);
+	move_last(previous_x);
+	move_last(previous_y);
+	move_last(previous_z);
+	move_last(velocity_x);
+	move_last(velocity_z);
+	move_last(heading);
+	move_last(material);
+	move_last(ai_state);
+	move_last(slot);
+	if (index != last)
+		slot_rover[slot[index]] = uint32_t(index);
+
+	slot_generation[handle.slot]++;
+	slot_rover[handle.slot] = first_free_slot;
+	first_free_slot = handle.slot;
+	return true;
+}
+
+bool RoverEntities::IsAlive(RoverHandle handle) const
+{
+	return handle.slot < slot_generation.size() && slot_generation[handle.slot] == handle.generation;
+}
+
+size_t RoverEntities::Index(RoverHandle handle) const
+{
+	return slot_rover[handle.slot];
+}
+
+glm::vec3 RoverEntities::InterpolatedPosition(size_t index, float alpha) const
+{
+	return glm::mix(glm::vec3(previous_x[index], previous_y[index], previous_z[index]), Position(index), alpha);
+}
+
+void RoverEntities::SavePrevious()
+{
+	previous_x = x;
+	previous_y = y;
+	previous_z = z;
+}
+
+/* Rover Systems */
+
+float PursuitGapKept(PursuitMode mode, float step_seconds)
+{
+	return mode == PURSUIT_LERP ? pursuit_lerp_gap_kept : std::exp(-pursuit_rate * step_seconds);
+}
+
+void PursueTarget(RoverEntities& rovers, const glm::vec3& target, float gap_kept, float step_seconds, size_t begin, size_t end)
+{
+	end = std::min(end, rovers.Count());
+	if (begin >= end)
+		return;
+	PursueKernel(rovers.x.data() + begin, rovers.z.data() + begin, rovers.velocity_x.data() + begin, rovers.velocity_z.data() + begin,
+		rovers.ai_state.data() + begin, end - begin, target.x, target.z, gap_kept, step_seconds);
+}
+
+void PursueKernel(float * x, float * z, float * velocity_x, float * velocity_z, const RoverAiState * ai_state, size_t count,
+	float target_x, float target_z, float gap_kept, float step_seconds, bool vectorized)
+{
+	// new = target + (old - target) * gap_kept, the lerp the game always did, in the same operation order on
+	// both paths so they agree to the bit
+	float inverse_step = 1.f / step_seconds;
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	if (vectorized)
+	{
+		const __m256 tx = _mm256_set1_ps(target_x), tz = _mm256_set1_ps(target_z);
+		const __m256 kept = _mm256_set1_ps(gap_kept), inverse = _mm256_set1_ps(inverse_step);
+		const __m256i pursue_state = _mm256_set1_epi32(ROVER_AI_PURSUE);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i state = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(ai_state + i)));
+			__m256 pursue = _mm256_castsi256_ps(_mm256_cmpeq_epi32(state, pursue_state));
+
+			__m256 old_x = _mm256_loadu_ps(x + i), old_z = _mm256_loadu_ps(z + i);
+			__m256 new_x = _mm256_add_ps(tx, _mm256_mul_ps(_mm256_sub_ps(old_x, tx), kept));
+			__m256 new_z = _mm256_add_ps(tz, _mm256_mul_ps(_mm256_sub_ps(old_z, tz), kept));
+			new_x = _mm256_blendv_ps(old_x, new_x, pursue);
+			new_z = _mm256_blendv_ps(old_z, new_z, pursue);
+
+			_mm256_storeu_ps(velocity_x + i, _mm256_mul_ps(_mm256_sub_ps(new_x, old_x), inverse));
+			_mm256_storeu_ps(velocity_z + i, _mm256_mul_ps(_mm256_sub_ps(new_z, old_z), inverse));
+			_mm256_storeu_ps(x + i, new_x);
+			_mm256_storeu_ps(z + i, new_z);
+		}
+	}
+#else
+	(void)vectorized;
+#endif
+
+	// Remainder, and everything on targets without AVX2
+	for (; i < count; ++i)
+	{
+		float new_x = x[i], new_z = z[i];
+		if (ai_state[i] == ROVER_AI_PURSUE)
+		{
+			new_x = target_x + (x[i] - target_x) * gap_kept;
+			new_z = target_z + (z[i] - target_z) * gap_kept;
+		}
+		velocity_x[i] = (new_x - x[i]) * inverse_step;
+		velocity_z[i] = (new_z - z[i]) * inverse_step;
+		x[i] = new_x;
+		z[i] = new_z;
+	}
+}
+
+void FollowFlowField(RoverEntities& rovers, const FlowField& field, const glm::vec3& target, float gap_kept, float step_seconds,
+	float direct_distance, size_t begin, size_t end)
+{
+	float inverse_step = 1.f / step_seconds;
+	end = std::min(end, rovers.Count());
+	for (size_t i = begin; i < end; ++i)
+	{
+		float new_x = rovers.x[i], new_z = rovers.z[i];
+		if (rovers.ai_state[i] == ROVER_AI_PURSUE)
+		{
+			float gap_x = target.x - rovers.x[i], gap_z = target.z - rovers.z[i];
+			float gap = std::sqrt(gap_x * gap_x + gap_z * gap_z);
+
+			// The field runs along the sphere, the rovers drive on the plane, so its direction is flattened
+			float flow_x = 0.f, flow_z = 0.f, flow = 0.f;
+			if (field.ready && gap > direct_distance)
+			{
+				uint32_t cell = field.Cell(rovers.Position(i));
+				flow_x = field.direction_x[cell];
+				flow_z = field.direction_z[cell];
+				flow = std::sqrt(flow_x * flow_x + flow_z * flow_z);
+			}
+
+			if (flow > 1e-6f)
+			{
+				float step = gap * (1.f - gap_kept) / flow;
+				new_x += flow_x * step;
+				new_z += flow_z * step;
+			}
+			else
+			{
+				new_x = target.x + (rovers.x[i] - target.x) * gap_kept;
+				new_z = target.z + (rovers.z[i] - target.z) * gap_kept;
+			}
+		}
+		rovers.velocity_x[i] = (new_x - rovers.x[i]) * inverse_step;
+		rovers.velocity_z[i] = (new_z - rovers.z[i]) * inverse_step;
+		rovers.x[i] = new_x;
+		rovers.z[i] = new_z;
+	}
+}
+
+void UpdateHeadings(RoverEntities& rovers, size_t begin, size_t end)
+{
+	// The model looks down -z
+	end = std::min(end, rovers.Count());
+	for (size_t i = begin; i < end; ++i)
+		if (rovers.velocity_x[i] != 0.f || rovers.velocity_z[i] != 0.f)
+			rovers.heading[i] = std::atan2(-rovers.velocity_x[i], -rovers.velocity_z[i]);
+}
+
+void SeparateRovers(RoverEntities& rovers, const std::vector<RoverPair>& pairs, float extent)
+{
+	for (const auto& pair : pairs)
+	{
+		float share_a = rovers.ai_state[pair.a] == ROVER_AI_PURSUE ? 1.f : 0.f;
+		float share_b = rovers.ai_state[pair.b] == ROVER_AI_PURSUE ? 1.f : 0.f;
+		if (share_a + share_b == 0.f)
+			continue;
+		share_a /= share_a + share_b;
+		share_b = 1.f - share_a;
+
+		// Earlier pushes of this step may have separated them already
+		float dx = rovers.x[pair.b] - rovers.x[pair.a], dz = rovers.z[pair.b] - rovers.z[pair.a];
+		float overlap_x = extent - std::abs(dx), overlap_z = extent - std::abs(dz);
+		if (overlap_x <= 0.f || overlap_z <= 0.f)
+			continue;
+
+		if (overlap_x < overlap_z)
+		{
+			float push = dx < 0.f ? -overlap_x : overlap_x;
+			rovers.x[pair.a] -= push * share_a;
+			rovers.x[pair.b] += push * share_b;
+		}
+		else
+		{
+			float push = dz < 0.f ? -overlap_z : overlap_z;
+			rovers.z[pair.a] -= push * share_a;
+			rovers.z[pair.b] += push * share_b;
+		}
+	}
+}
+
+void SetAllRovers(RoverEntities& rovers, RoverMaterial rover_material, RoverAiState rover_ai_state)
+{
+	std::fill(rovers.material.begin(), rovers.material.end(), rover_material);
+	std::fill(rovers.ai_state.begin(), rovers.ai_state.end(), rover_ai_state);
+}
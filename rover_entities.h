@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "flow_field.h"
+#include "spatial_hash.h"
+
+/* Rover Entity Structs */
+
+enum RoverMaterial : uint8_t
+{
+	ROVER_MATERIAL_ENEMY,
+	ROVER_MATERIAL_WINNER, // caught the player
+};
+
+enum RoverAiState : uint8_t
+{
+	ROVER_AI_PURSUE, // closes in on the player every simulation step
+	ROVER_AI_IDLE,
+};
+
+enum PursuitMode
+{
+	PURSUIT_LERP, // a fixed fraction of the gap per step, faster with more steps per second
+	PURSUIT_EXPONENTIAL, // exp(-rate * dt) of the gap, the same speed at any step length
+};
+
+// The game's enemies always closed 0.1% of the gap per frame, at 60 frames per second that is this rate
+const float pursuit_lerp_gap_kept = 0.999f;
+const float pursuit_rate = 0.0600300f; // -60 * ln(0.999), per second
+
+// Refers to one rover for as long as it lives. Slots are reused after a despawn, the generation tells a
+// stale handle from the slot's new owner.
+struct RoverHandle
+{
+	uint32_t slot;
+	uint32_t generation;
+};
+
+// Enemy rovers as structure-of-arrays components. Live rovers are packed at the front of every array, so
+// each system is one pass over contiguous memory no matter how often rovers come and go: despawning moves
+// the last rover into the hole. Handles go through a slot table whose unused entries form a free list.
+struct RoverEntities
+{
+	// Components, index i of every array is the same rover
+	std::vector<float> x, y, z;
+	std::vector<float> previous_x, previous_y, previous_z; // before the last simulation step, for drawing in between
+	std::vector<float> velocity_x, velocity_z; // per second, on the plane the rovers drive in
+	std::vector<float> heading; // radians about +y, 0 faces -z like the rover model, follows velocity
+	std::vector<RoverMaterial> material;
+	std::vector<RoverAiState> ai_state;
+	std::vector<uint32_t> slot; // owning slot, to fix up the slot table when a rover moves
+
+	// Slot table, an unused slot holds the next free slot instead of a rover index
+	std::vector<uint32_t> slot_rover;
+	std::vector<uint32_t> slot_generation;
+	uint32_t first_free_slot;
+
+	RoverEntities();
+
+	RoverHandle Spawn(const glm::vec3& position, RoverMaterial material, RoverAiState ai_state);
+	// False if the handle is stale
+	bool Despawn(RoverHandle handle);
+
+	bool IsAlive(RoverHandle handle) const;
+	size_t Index(RoverHandle handle) const; // of a live handle
+
+	size_t Count() const { return x.size(); }
+	glm::vec3 Position(size_t index) const { return glm::vec3(x[index], y[index], z[index]); }
+	glm::vec3 InterpolatedPosition(size_t index, float alpha) const;
+
+	// Called before every simulation step
+	void SavePrevious();
+};
+
+/* Rover Systems */
+
+// Systems that take begin and end only touch those rovers, so jobs can run them on separate ranges. The end is
+// clamped to the rover count.
+
+// Fraction of its distance to the target a pursuing rover keeps over one step
+float PursuitGapKept(PursuitMode mode, float step_seconds);
+
+// Every pursuing rover keeps gap_kept of its distance to the target on the x/z plane and gets the velocity
+// that took it there, the others stand still
+void PursueTarget(RoverEntities& rovers, const glm::vec3& target, float gap_kept, float step_seconds,
+	size_t begin = 0, size_t end = SIZE_MAX);
+
+// The same on bare component arrays, 8 rovers per instruction with AVX2. "vectorized" false runs the
+// scalar loop that handles the remainder and targets without AVX2, to compare the two.
+void PursueKernel(float * x, float * z, float * velocity_x, float * velocity_z, const RoverAiState * ai_state, size_t count,
+	float target_x, float target_z, float gap_kept, float step_seconds, bool vectorized = true);
+
+// Pursuit for large crowds: pursuing rovers close the same share of their gap to the target as PursueTarget, but
+// drive along the flow field instead of straight at it, so they find their way around whatever the field avoids.
+// Within direct_distance of the target, and while the field has no answer, they head straight for it.
+void FollowFlowField(RoverEntities& rovers, const FlowField& field, const glm::vec3& target, float gap_kept, float step_seconds,
+	float direct_distance, size_t begin = 0, size_t end = SIZE_MAX);
+
+// Turns moving rovers to face their velocity. Once per rendered frame, atan2 does not vectorize.
+void UpdateHeadings(RoverEntities& rovers, size_t begin = 0, size_t end = SIZE_MAX);
+
+// Rovers are axis-aligned boxes of size extent on x and z. Pushes the rovers of every overlapping pair from the
+// broadphase apart along the axis they overlap least on, so a crowd does not collapse into one spot. Idle
+// rovers stay put and the pursuing one takes the whole push.
+void SeparateRovers(RoverEntities& rovers, const std::vector<RoverPair>& pairs, float extent);
+
+void SetAllRovers(RoverEntities& rovers, RoverMaterial material, RoverAiState ai_state);
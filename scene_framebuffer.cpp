@@ -0,0 +1,112 @@
+#include "scene_framebuffer.h"
+
+#include <cmath>
+#include <iostream>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+/* Scene Framebuffer */
+
+SceneFramebuffer::SceneFramebuffer(DepthMode requested_mode, bool offscreen)
+	: mode(requested_mode), offscreen(offscreen), framebuffer(0), color(0), depth(0), width(0), height(0)
+{
+	// Without clip control, NDC depth -1..1 is squeezed into 0..1 and reversed-Z loses its point
+	if (mode == DEPTH_MODE_REVERSED_Z && !(GLAD_GL_ARB_clip_control && glClipControl != NULL))
+	{
+		std::cout << "Reversed-Z needs ARB_clip_control, using the standard depth buffer" << std::endl;
+		mode = DEPTH_MODE_STANDARD;
+	}
+	if (mode == DEPTH_MODE_REVERSED_Z)
+		this->offscreen = true;
+}
+
+glm::mat4 SceneFramebuffer::Projection(float fov_y_radians, float aspect, float near, float far) const
+{
+	// The camera view is left-handed (see main.cpp), so both projections look down +z
+	if (mode == DEPTH_MODE_STANDARD)
+		return glm::perspectiveLH(fov_y_radians, aspect, near, far);
+
+	// Clip z is the constant "near" and w the view distance, so NDC depth is near / distance
+	float focal_length = 1.f / std::tan(fov_y_radians / 2.f);
+	glm::mat4 projection(0.f);
+	projection[0][0] = focal_length / aspect;
+	projection[1][1] = focal_length;
+	projection[2][3] = 1.f;
+	projection[3][2] = near;
+	return projection;
+}
+
+GLenum SceneFramebuffer::DepthCompare() const
+{
+	return mode == DEPTH_MODE_REVERSED_Z ? GL_GREATER : GL_LESS;
+}
+
+void SceneFramebuffer::Begin(int width, int height)
+{
+	if (!offscreen)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, width, height);
+		glDepthFunc(GL_LESS);
+		glClearDepth(1.0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		return;
+	}
+
+	if (framebuffer == 0)
+	{
+		glGenFramebuffers(1, &framebuffer);
+		glGenRenderbuffers(1, &color);
+		glGenRenderbuffers(1, &depth);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	if (width != this->width || height != this->height)
+	{
+		this->width = width;
+		this->height = height;
+
+		glBindRenderbuffer(GL_RENDERBUFFER, color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, mode == DEPTH_MODE_REVERSED_Z ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "Error: Scene framebuffer is incomplete" << std::endl;
+	}
+
+	glViewport(0, 0, width, height);
+	if (mode == DEPTH_MODE_REVERSED_Z)
+	{
+		glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+		glDepthFunc(GL_GREATER);
+		glClearDepth(0.0);
+	}
+	else
+	{
+		glDepthFunc(GL_LESS);
+		glClearDepth(1.0);
+	}
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void SceneFramebuffer::End(int window_width, int window_height)
+{
+	if (!offscreen)
+		return;
+
+	GLenum filter = width == window_width && height == window_height ? GL_NEAREST : GL_LINEAR;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, window_width, window_height, GL_COLOR_BUFFER_BIT, filter);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, window_width, window_height);
+
+	// Anything drawn after the scene gets the default convention back
+	if (mode == DEPTH_MODE_REVERSED_Z)
+		glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include "glad/glad.h"
+
+/* Scene Framebuffer Structs */
+
+enum DepthMode
+{
+	DEPTH_MODE_STANDARD,
+	// 1 at the near plane falling towards 0 at infinity, in a 32-bit float depth buffer. Float precision
+	// grows towards 0 and cancels the 1/z falloff, so depth resolution stays even from the near plane out.
+	DEPTH_MODE_REVERSED_Z,
+};
+
+// Where the scene is rendered. In the standard mode that is the window's framebuffer, reversed-Z draws
+// into an offscreen color + GL_DEPTH_COMPONENT32F target that End() blits to the window. A standard
+// mode scene can be sent offscreen too, to render at a size other than the window's.
+struct SceneFramebuffer
+{
+	DepthMode mode;
+	bool offscreen;
+
+	GLuint framebuffer;
+	GLuint color;
+	GLuint depth;
+	int width;
+	int height;
+
+	// Falls back to DEPTH_MODE_STANDARD without ARB_clip_control
+	SceneFramebuffer(DepthMode requested_mode, bool offscreen = false);
+
+	// No GL calls in the destructor, the context is gone by the time main's locals are destroyed
+	SceneFramebuffer(const SceneFramebuffer&) = delete;
+	SceneFramebuffer& operator=(const SceneFramebuffer&) = delete;
+
+	// "far" is only used by the standard mode, reversed-Z projects to infinity
+	glm::mat4 Projection(float fov_y_radians, float aspect, float near, float far) const;
+
+	// GL_LESS or GL_GREATER, for whoever changes the depth test and has to put it back
+	GLenum DepthCompare() const;
+
+	// Binds, resizes if needed, sets up depth state and clears color and depth
+	void Begin(int width, int height);
+
+	// Scales the offscreen target to the window if the sizes differ
+	void End(int window_width, int window_height);
+};
@@ -0,0 +1,77 @@
+#include "shader_variants.h"
+
+/* Shader Variant Structs */
+
+ShaderVariantCache::ShaderVariantCache(const GLchar * vertex_shader_source, const GLchar * fragment_shader_source, AsyncProgramBuilder& builder)
+	: vertex_shader_source(vertex_shader_source), fragment_shader_source(fragment_shader_source), builder(builder)
+{
+}
+
+void ShaderVariantCache::Request(unsigned features)
+{
+	if (variants.count(features) || pending.count(features))
+		return;
+
+	auto defines = ShaderDefinesFromFeatures(features);
+	pending[features] = builder.Submit(InjectShaderDefines(vertex_shader_source, defines), InjectShaderDefines(fragment_shader_source, defines));
+}
+
+const ShaderVariant * ShaderVariantCache::Get(unsigned features)
+{
+	auto cached = variants.find(features);
+	if (cached != variants.end())
+		return &cached->second;
+
+	Request(features);
+	auto handle = pending[features];
+	pending.erase(features);
+
+	GLuint program = builder.Resolve(handle);
+	if (program == NULL)
+	{
+		std::cout << "Error: Shader variant " << features << " could not be built" << std::endl;
+		return NULL;
+	}
+
+	ShaderVariant variant;
+	variant.program = program;
+	variant.model_location = glGetUniformLocation(program, "u_model");
+	variant.projection_view_location = glGetUniformLocation(program, "u_projection_view");
+	variant.color_location = glGetUniformLocation(program, "u_color");
+	variant.texture_location = glGetUniformLocation(program, "u_texture");
+
+	// Samplers never change unit, so bind them once here instead of per draw
+	if (variant.texture_location != -1)
+	{
+		glUseProgram(program);
+		glUniform1i(variant.texture_location, 0);
+	}
+
+	return &variants.emplace(features, variant).first->second;
+}
+
+/* Shader Variant Functions */
+
+std::string ShaderDefinesFromFeatures(unsigned features)
+{
+	std::string defines;
+
+	if (features & SHADER_FEATURE_TEXTURED)
+		defines += "#define MATERIAL_TEXTURED\n";
+	if (features & SHADER_FEATURE_FLAT_COLOR)
+		defines += "#define MATERIAL_FLAT_COLOR\n";
+	if (features & SHADER_FEATURE_TIRE)
+		defines += "#define MATERIAL_TIRE\n";
+	if (features & SHADER_FEATURE_VIRTUAL_TEXTURE)
+		defines += "#define MATERIAL_VIRTUAL_TEXTURE\n";
+	if (features & SHADER_FEATURE_VIRTUAL_TEXTURE_FEEDBACK)
+		defines += "#define VIRTUAL_TEXTURE_FEEDBACK\n";
+	if (features & SHADER_FEATURE_DEPTH_ONLY)
+		defines += "#define DEPTH_ONLY\n";
+	if (features & SHADER_FEATURE_GBUFFER)
+		defines += "#define GBUFFER\n";
+	if (features & SHADER_FEATURE_DEFERRED_LIGHTING)
+		defines += "#define DEFERRED_LIGHTING\n";
+
+	return defines;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include "opengl_utilities.h"
+#include "program_builder.h"
+
+/* Shader Permutation Features */
+
+// Each bit turns into a #define in the specialized program, e.g. SHADER_FEATURE_TEXTURED -> "#define MATERIAL_TEXTURED"
+enum ShaderFeature
+{
+	SHADER_FEATURE_TEXTURED = 1 << 0,
+	SHADER_FEATURE_FLAT_COLOR = 1 << 1,
+	SHADER_FEATURE_TIRE = 1 << 2,
+	SHADER_FEATURE_VIRTUAL_TEXTURE = 1 << 3,
+	SHADER_FEATURE_VIRTUAL_TEXTURE_FEEDBACK = 1 << 4,
+	SHADER_FEATURE_DEPTH_ONLY = 1 << 5,
+	SHADER_FEATURE_GBUFFER = 1 << 6,
+	SHADER_FEATURE_DEFERRED_LIGHTING = 1 << 7,
+};
+
+/* Shader Variant Structs */
+
+struct ShaderVariant
+{
+	GLuint program;
+
+	GLint model_location;
+	GLint projection_view_location;
+	GLint color_location;
+	GLint texture_location;
+};
+
+struct ShaderVariantCache
+{
+	const GLchar * vertex_shader_source;
+	const GLchar * fragment_shader_source;
+
+	AsyncProgramBuilder& builder;
+
+	// Submitted to the builder but not resolved yet, feature bits -> builder handle
+	std::unordered_map<unsigned, size_t> pending;
+	std::unordered_map<unsigned, ShaderVariant> variants;
+
+	ShaderVariantCache(const GLchar * vertex_shader_source, const GLchar * fragment_shader_source, AsyncProgramBuilder& builder);
+
+	// Starts building the permutation in the background, call early for everything the scene will use
+	void Request(unsigned features);
+
+	// Returns the program specialized for "features", waiting for (or starting) its build on the first call. NULL if it failed.
+	const ShaderVariant * Get(unsigned features);
+};
+
+/* Shader Variant Functions */
+
+std::string ShaderDefinesFromFeatures(unsigned features);
@@ -0,0 +1,209 @@
+#include "shadow_maps.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+/* Cascaded Shadow Maps */
+
+CascadedShadowMaps::CascadedShadowMaps(int resolution, int dynamic_cascade_count, float caster_extent)
+	: resolution(resolution), dynamic_cascade_count(dynamic_cascade_count), static_cascade_slack(0.25f),
+	light_change_threshold(std::cos(glm::radians(0.5f))), caster_extent(caster_extent), cascades(shadow_cascade_count), cascades_rendered(0)
+{
+	for (auto& cascade : cascades)
+	{
+		cascade.near_depth = cascade.far_depth = 0.f;
+		cascade.light_projection_view = glm::mat4(1.f);
+		cascade.needs_render = true;
+		cascade.cached_center = glm::vec3(0.f);
+		cascade.cached_radius = 0.f;
+		cascade.cached_light_direction = glm::vec3(0.f);
+	}
+
+	glGenTextures(1, &depth_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depth_texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, resolution, resolution, shadow_cascade_count, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+	// Outside a cascade counts as lit
+	const float border[4] = { 1.f, 1.f, 1.f, 1.f };
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	GLint previous_framebuffer;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_framebuffer);
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Error: Shadow map framebuffer is incomplete" << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+
+	// Shadows stay off until the first Render, the light is the one the shader always used
+	block = ShadowCascadesBlock();
+	block.light_direction = glm::vec4(glm::normalize(glm::vec3(1, 1, -1)), 0.f);
+
+	glGenBuffers(1, &uniform_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowCascadesBlock), &block, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, uniform_block_binding, uniform_buffer);
+}
+
+void CascadedShadowMaps::SetupProgram(GLuint program) const
+{
+	GLuint block_index = glGetUniformBlockIndex(program, "ShadowCascades");
+	if (block_index != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, block_index, uniform_block_binding);
+
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "u_shadow_map"), shadow_map_unit);
+}
+
+void CascadedShadowMaps::Update(const glm::vec3& camera_position, const glm::vec3& camera_forward, const glm::vec3& camera_up,
+	float fov_y_radians, float aspect, float near_depth, float far_depth, const glm::vec3& light_direction)
+{
+	glm::vec3 forward = glm::normalize(camera_forward);
+	glm::vec3 right = glm::normalize(glm::cross(forward, camera_up));
+	glm::vec3 up = glm::cross(right, forward);
+	float tan_half_fov = std::tan(fov_y_radians / 2.f);
+
+	for (int i = 0; i < shadow_cascade_count; ++i)
+	{
+		auto& cascade = cascades[i];
+
+		// Logarithmic splits, the range goes from a single rover to the whole planet
+		cascade.near_depth = near_depth * std::pow(far_depth / near_depth, float(i) / shadow_cascade_count);
+		cascade.far_depth = near_depth * std::pow(far_depth / near_depth, float(i + 1) / shadow_cascade_count);
+
+		// Bounding sphere of the view slice, its size does not change with the camera's orientation
+		glm::vec3 center(0.f);
+		glm::vec3 corners[8];
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			float depth = (corner & 4) ? cascade.far_depth : cascade.near_depth;
+			float half_height = depth * tan_half_fov;
+			corners[corner] = camera_position + forward * depth
+				+ right * (half_height * aspect * ((corner & 1) ? 1.f : -1.f))
+				+ up * (half_height * ((corner & 2) ? 1.f : -1.f));
+			center += corners[corner] / 8.f;
+		}
+		float radius = 0.f;
+		for (const auto& corner : corners)
+			radius = std::max(radius, glm::length(corner - center));
+
+		if (i < dynamic_cascade_count)
+		{
+			cascade.light_projection_view = FitCascade(center, radius, light_direction, caster_extent, resolution);
+			cascade.cached_radius = radius;
+			continue;
+		}
+
+		bool light_moved = glm::dot(cascade.cached_light_direction, light_direction) < light_change_threshold;
+		bool slice_escaped = glm::length(center - cascade.cached_center) + radius > cascade.cached_radius;
+		if (light_moved || slice_escaped)
+		{
+			cascade.cached_center = center;
+			cascade.cached_radius = radius * (1.f + static_cascade_slack);
+			cascade.cached_light_direction = light_direction;
+			cascade.light_projection_view = FitCascade(center, cascade.cached_radius, light_direction, caster_extent, resolution);
+			cascade.needs_render = true;
+		}
+	}
+
+	for (int i = 0; i < shadow_cascade_count; ++i)
+	{
+		block.cascade_matrices[i] = cascades[i].light_projection_view;
+		block.cascade_splits[i] = cascades[i].far_depth;
+		block.cascade_texel_sizes[i] = 2.f * cascades[i].cached_radius / resolution;
+	}
+	block.light_direction = glm::vec4(light_direction, 1.f);
+	block.camera_position = glm::vec4(camera_position, 1.f);
+	block.camera_forward = glm::vec4(forward, 0.f);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ShadowCascadesBlock), &block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void CascadedShadowMaps::Render(const std::function<void(const glm::mat4& light_projection_view, bool static_only)>& draw_casters)
+{
+	GLint previous_framebuffer, previous_viewport[4], previous_depth_func, previous_clip_depth = GL_NEGATIVE_ONE_TO_ONE;
+	GLfloat previous_clear_depth;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_framebuffer);
+	glGetIntegerv(GL_VIEWPORT, previous_viewport);
+	glGetIntegerv(GL_DEPTH_FUNC, &previous_depth_func);
+	glGetFloatv(GL_DEPTH_CLEAR_VALUE, &previous_clear_depth);
+
+	// The cascade matrices are plain -1..1 depth projections, whatever the scene uses
+	bool clip_control = GLAD_GL_ARB_clip_control && glClipControl != NULL;
+	if (clip_control)
+	{
+		glGetIntegerv(GL_CLIP_DEPTH_MODE, &previous_clip_depth);
+		glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, resolution, resolution);
+	glDepthFunc(GL_LESS);
+	glClearDepth(1.0);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.f, 4.f);
+
+	cascades_rendered = 0;
+	for (int i = 0; i < shadow_cascade_count; ++i)
+	{
+		bool is_static = i >= dynamic_cascade_count;
+		if (is_static && !cascades[i].needs_render)
+			continue;
+
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture, 0, i);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		draw_casters(cascades[i].light_projection_view, is_static);
+
+		cascades[i].needs_render = false;
+		cascades_rendered++;
+	}
+
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	if (clip_control)
+		glClipControl(GL_LOWER_LEFT, previous_clip_depth);
+	glClearDepth(previous_clear_depth);
+	glDepthFunc(previous_depth_func);
+	glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2], previous_viewport[3]);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+}
+
+void CascadedShadowMaps::Bind() const
+{
+	glActiveTexture(GL_TEXTURE0 + shadow_map_unit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depth_texture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+glm::mat4 CascadedShadowMaps::FitCascade(const glm::vec3& center, float radius, const glm::vec3& light_direction, float caster_extent, int resolution)
+{
+	// Light space is anchored at the origin, not at the cascade, so snapping to its texel grid stops edges from crawling
+	glm::vec3 up = std::abs(light_direction.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+	// Handedness is spelled out, main.cpp forces glm to left handed and the generic functions would differ per file
+	glm::mat4 light_view = glm::lookAtRH(glm::vec3(0.f), -light_direction, up);
+
+	glm::vec3 light_center = glm::vec3(light_view * glm::vec4(center, 1.f));
+	float texel_size = 2.f * radius / resolution;
+	light_center.x = std::floor(light_center.x / texel_size) * texel_size;
+	light_center.y = std::floor(light_center.y / texel_size) * texel_size;
+
+	// The view looks down -z, casters up to caster_extent towards the light still land in the map
+	glm::mat4 projection = glm::orthoRH(light_center.x - radius, light_center.x + radius, light_center.y - radius, light_center.y + radius,
+		-light_center.z - radius - caster_extent, -light_center.z + radius);
+	return projection * light_view;
+}
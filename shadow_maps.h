@@ -0,0 +1,84 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glad/glad.h"
+
+/* Shadow Map Structs */
+
+const int shadow_cascade_count = 4;
+
+// Matches the std140 "ShadowCascades" block in the scene fragment shader
+struct ShadowCascadesBlock
+{
+	glm::mat4 cascade_matrices[shadow_cascade_count];
+	glm::vec4 cascade_splits;   // far view depth of each cascade
+	glm::vec4 cascade_texel_sizes;
+	glm::vec4 light_direction;  // towards the light, w is 1 when shadows are on
+	glm::vec4 camera_position;
+	glm::vec4 camera_forward;
+};
+
+struct ShadowCascade
+{
+	float near_depth;
+	float far_depth;
+	glm::mat4 light_projection_view;
+
+	// Static cascades only: the padded sphere the cached map was rendered for and the light it used
+	bool needs_render;
+	glm::vec3 cached_center;
+	float cached_radius;
+	glm::vec3 cached_light_direction;
+};
+
+// Cascaded shadow maps for one directional light, stored in a depth texture array. The first
+// dynamic_cascade_count cascades are rendered every frame with everything; the rest only see
+// static casters (the planet), are fitted with some slack and stay cached until the view slice
+// leaves that slack or the light turns by more than the threshold.
+struct CascadedShadowMaps
+{
+	static const int shadow_map_unit = 3;
+	static const GLuint uniform_block_binding = 0;
+
+	int resolution;
+	int dynamic_cascade_count;
+	float static_cascade_slack;
+	float light_change_threshold; // cosine
+
+	// How far behind a cascade casters may be, the planet's diameter covers everything
+	float caster_extent;
+
+	std::vector<ShadowCascade> cascades;
+
+	GLuint depth_texture;
+	GLuint framebuffer;
+	GLuint uniform_buffer;
+
+	ShadowCascadesBlock block;
+
+	// Renders for the statistics of the last frame
+	int cascades_rendered;
+
+	CascadedShadowMaps(int resolution = 2048, int dynamic_cascade_count = 2, float caster_extent = 2.f);
+
+	CascadedShadowMaps(const CascadedShadowMaps&) = delete;
+	CascadedShadowMaps& operator=(const CascadedShadowMaps&) = delete;
+
+	// Binds the program's ShadowCascades block and shadow sampler
+	void SetupProgram(GLuint program) const;
+
+	// Splits [near_depth, far_depth] of the camera and refits the cascades to it
+	void Update(const glm::vec3& camera_position, const glm::vec3& camera_forward, const glm::vec3& camera_up,
+		float fov_y_radians, float aspect, float near_depth, float far_depth, const glm::vec3& light_direction);
+
+	// Re-renders the cascades that need it. "draw_casters" draws depth only with the given matrix,
+	// only static casters when asked to. GL state touched here is restored afterwards.
+	void Render(const std::function<void(const glm::mat4& light_projection_view, bool static_only)>& draw_casters);
+
+	void Bind() const;
+
+	static glm::mat4 FitCascade(const glm::vec3& center, float radius, const glm::vec3& light_direction, float caster_extent, int resolution);
+};
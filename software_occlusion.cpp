@@ -0,0 +1,203 @@
+#include "software_occlusion.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+/* Occlusion Buffer */
+
+OcclusionBuffer::OcclusionBuffer(int width, int height)
+	: width((width + tile_size - 1) / tile_size * tile_size), height((height + tile_size - 1) / tile_size * tile_size), view_projection(1.f)
+{
+	tiles_x = this->width / tile_size;
+	tiles_y = this->height / tile_size;
+	inverse_w.assign(size_t(this->width) * this->height, 0.f);
+	tile_min_inverse_w.assign(size_t(tiles_x) * tiles_y, 0.f);
+}
+
+void OcclusionBuffer::Clear(const glm::mat4& view_projection)
+{
+	this->view_projection = view_projection;
+	std::fill(inverse_w.begin(), inverse_w.end(), 0.f);
+	std::fill(tile_min_inverse_w.begin(), tile_min_inverse_w.end(), 0.f);
+}
+
+void OcclusionBuffer::RasterizeMesh(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, const glm::mat4& model)
+{
+	auto mvp = view_projection * model;
+
+	std::vector<glm::vec4> clip(positions.size());
+	for (size_t i = 0; i < positions.size(); ++i)
+		clip[i] = mvp * glm::vec4(positions[i], 1.f);
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		RasterizeTriangle(clip[indices[i]], clip[indices[i + 1]], clip[indices[i + 2]]);
+}
+
+void OcclusionBuffer::RasterizeTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+{
+	// Triangles touching the near plane are dropped, an occluder missing is always safe
+	const float min_w = 1e-7f;
+	if (a.w <= min_w || b.w <= min_w || c.w <= min_w)
+		return;
+
+	const glm::vec4 * clip[3] = { &a, &b, &c };
+	float sx[3], sy[3], iw[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		iw[k] = 1.f / clip[k]->w;
+		sx[k] = (clip[k]->x * iw[k] * 0.5f + 0.5f) * width;
+		sy[k] = (clip[k]->y * iw[k] * 0.5f + 0.5f) * height;
+	}
+
+	float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+	if (std::abs(area) < 1e-12f)
+		return;
+
+	// Orient so the edge functions are positive inside, whatever the winding
+	if (area < 0.f)
+	{
+		std::swap(sx[1], sx[2]);
+		std::swap(sy[1], sy[2]);
+		std::swap(iw[1], iw[2]);
+		area = -area;
+	}
+
+	int min_x = std::max(0, int(std::floor(std::min({ sx[0], sx[1], sx[2] }))));
+	int max_x = std::min(width - 1, int(std::ceil(std::max({ sx[0], sx[1], sx[2] }))));
+	int min_y = std::max(0, int(std::floor(std::min({ sy[0], sy[1], sy[2] }))));
+	int max_y = std::min(height - 1, int(std::ceil(std::max({ sy[0], sy[1], sy[2] }))));
+	if (min_x > max_x || min_y > max_y)
+		return;
+
+	// Edge k is opposite vertex k, its value at (x, y) is e_a * x + e_b * y + e_c
+	float edge_a[3], edge_b[3], edge_c[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		int i = (k + 1) % 3, j = (k + 2) % 3;
+		edge_a[k] = sy[i] - sy[j];
+		edge_b[k] = sx[j] - sx[i];
+		edge_c[k] = sx[i] * sy[j] - sx[j] * sy[i];
+	}
+
+	// 1/w as a plane over the screen, so each pixel is one multiply-add per axis
+	float inverse_area = 1.f / area;
+	float depth_a = (edge_a[0] * iw[0] + edge_a[1] * iw[1] + edge_a[2] * iw[2]) * inverse_area;
+	float depth_b = (edge_b[0] * iw[0] + edge_b[1] * iw[1] + edge_b[2] * iw[2]) * inverse_area;
+	float depth_c = (edge_c[0] * iw[0] + edge_c[1] * iw[1] + edge_c[2] * iw[2]) * inverse_area;
+
+	// The buffer width is a multiple of 4, so spans of 4 never leave the row
+	min_x &= ~3;
+
+	for (int y = min_y; y <= max_y; ++y)
+	{
+		float py = y + 0.5f;
+		float * row = &inverse_w[size_t(y) * width];
+
+#if defined(OCCLUSION_SSE)
+		const __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+		for (int x = min_x; x <= max_x; x += 4)
+		{
+			__m128 px = _mm_add_ps(_mm_set1_ps(float(x)), lane);
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int k = 0; k < 3; ++k)
+			{
+				__m128 edge = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(edge_a[k])), _mm_set1_ps(edge_b[k] * py + edge_c[k]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, _mm_setzero_ps()));
+			}
+			if (_mm_movemask_ps(inside) == 0)
+				continue;
+
+			__m128 depth = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(depth_a)), _mm_set1_ps(depth_b * py + depth_c));
+			__m128 previous = _mm_loadu_ps(row + x);
+			__m128 nearest = _mm_max_ps(previous, depth);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, previous)));
+		}
+#else
+		for (int x = min_x; x <= max_x; ++x)
+		{
+			float px = x + 0.5f;
+			bool inside = true;
+			for (int k = 0; k < 3; ++k)
+				inside = inside && edge_a[k] * px + edge_b[k] * py + edge_c[k] >= 0.f;
+			if (inside)
+				row[x] = std::max(row[x], depth_a * px + depth_b * py + depth_c);
+		}
+#endif
+	}
+}
+
+void OcclusionBuffer::BuildHierarchy()
+{
+	for (int ty = 0; ty < tiles_y; ++ty)
+		for (int tx = 0; tx < tiles_x; ++tx)
+		{
+			float farthest = INFINITY;
+			for (int y = ty * tile_size; y < (ty + 1) * tile_size; ++y)
+			{
+				const float * row = &inverse_w[size_t(y) * width + tx * tile_size];
+				farthest = std::min(farthest, *std::min_element(row, row + tile_size));
+			}
+			tile_min_inverse_w[size_t(ty) * tiles_x + tx] = farthest;
+		}
+}
+
+bool OcclusionBuffer::IsOccluded(const BoundingSphere& sphere) const
+{
+	// Screen bounds and nearest depth from the corners of the sphere's box. w is linear in
+	// position, so no point of the sphere is nearer than the nearest corner.
+	float min_x = INFINITY, max_x = -INFINITY, min_y = INFINITY, max_y = -INFINITY, nearest = 0.f;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		glm::vec3 offset((corner & 1) ? 1.f : -1.f, (corner & 2) ? 1.f : -1.f, (corner & 4) ? 1.f : -1.f);
+		auto clip = view_projection * glm::vec4(sphere.center + offset * sphere.radius, 1.f);
+		if (clip.w <= 1e-7f)
+			return false;
+
+		float iw = 1.f / clip.w;
+		min_x = std::min(min_x, clip.x * iw);
+		max_x = std::max(max_x, clip.x * iw);
+		min_y = std::min(min_y, clip.y * iw);
+		max_y = std::max(max_y, clip.y * iw);
+		nearest = std::max(nearest, iw);
+	}
+
+	int tile_min_x = std::max(0, int(std::floor((min_x * 0.5f + 0.5f) * width)) / tile_size);
+	int tile_max_x = std::min(tiles_x - 1, int(std::floor((max_x * 0.5f + 0.5f) * width)) / tile_size);
+	int tile_min_y = std::max(0, int(std::floor((min_y * 0.5f + 0.5f) * height)) / tile_size);
+	int tile_max_y = std::min(tiles_y - 1, int(std::floor((max_y * 0.5f + 0.5f) * height)) / tile_size);
+	if (tile_min_x > tile_max_x || tile_min_y > tile_max_y)
+		return false;
+
+	for (int ty = tile_min_y; ty <= tile_max_y; ++ty)
+		for (int tx = tile_min_x; tx <= tile_max_x; ++tx)
+			if (tile_min_inverse_w[size_t(ty) * tiles_x + tx] <= nearest)
+				return false;
+	return true;
+}
+
+/* Software Occlusion */
+
+SoftwareOcclusion::SoftwareOcclusion(int width, int height)
+	: buffer(width, height)
+{
+}
+
+size_t SoftwareOcclusion::AddOccluder(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices)
+{
+	occluders.push_back({ positions, indices, glm::mat4(1.f) });
+	return occluders.size() - 1;
+}
+
+void SoftwareOcclusion::Rasterize(const glm::mat4& view_projection)
+{
+	buffer.Clear(view_projection);
+	for (const auto& occluder : occluders)
+		buffer.RasterizeMesh(occluder.positions, occluder.indices, occluder.model);
+	buffer.BuildHierarchy();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glad/glad.h"
+#include "culling.h"
+
+/* Software Occlusion Structs */
+
+// Low resolution depth buffer rasterized on the CPU. It stores 1/w, which is linear in screen space and
+// keeps its precision with the game's tiny near plane: larger is nearer, 0 is empty.
+struct OcclusionBuffer
+{
+	static const int tile_size = 8;
+
+	int width;
+	int height;
+	glm::mat4 view_projection;
+
+	std::vector<float> inverse_w;
+
+	// Farthest occluder value per tile, 0 as soon as any pixel of the tile is empty
+	int tiles_x;
+	int tiles_y;
+	std::vector<float> tile_min_inverse_w;
+
+	// width and height are rounded up to tile_size
+	OcclusionBuffer(int width = 128, int height = 128);
+
+	void Clear(const glm::mat4& view_projection);
+	void RasterizeMesh(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, const glm::mat4& model);
+	void BuildHierarchy();
+
+	// Conservative: true only if every tile under the sphere's screen bounds has occluders nearer than the sphere
+	bool IsOccluded(const BoundingSphere& sphere) const;
+
+	void RasterizeTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+};
+
+struct Occluder
+{
+	std::vector<glm::vec3> positions;
+	std::vector<GLuint> indices;
+	glm::mat4 model;
+};
+
+// The occluders and the buffer they are rasterized into. Rasterize runs as a job of the frame
+// graph once the camera is known, culling against "buffer" depends on it.
+struct SoftwareOcclusion
+{
+	OcclusionBuffer buffer;
+	std::vector<Occluder> occluders;
+
+	SoftwareOcclusion(int width = 128, int height = 128);
+
+	// Occluders must lie inside the geometry they stand for, or visible objects get culled
+	size_t AddOccluder(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices);
+
+	void Rasterize(const glm::mat4& view_projection);
+};
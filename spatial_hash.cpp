@@ -0,0 +1,171 @@
+#include "spatial_hash.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "job_system.h"
+
+static const int phase_hash = 0;
+static const int phase_pairs = 1;
+
+// Below this many rovers handing out bands costs more than it saves
+static const size_t min_parallel_count = 8192;
+
+/* Spatial Hash */
+
+SpatialHash::SpatialHash(float cell_size, JobSystem * jobs)
+	: cell_size(cell_size), x(NULL), z(NULL), count(0), jobs(jobs)
+{
+}
+
+int32_t SpatialHash::Cell(float coordinate) const
+{
+	return int32_t(std::floor(coordinate / cell_size));
+}
+
+uint32_t SpatialHash::Bucket(int32_t cell_x, int32_t cell_z) const
+{
+	// Cells of a row land in consecutive buckets, so most neighbours a rover looks at are already in cache.
+	// bucket_start has one entry more than there are buckets, a power of two.
+	uint32_t hash = uint32_t(cell_x) + uint32_t(cell_z) * 1031u;
+	return hash & uint32_t(bucket_start.size() - 2);
+}
+
+bool SpatialHash::Overlap(float ax, float az, float bx, float bz) const
+{
+	// Same AABB test the game always used, boxes of cell_size on x and z
+	return ax + cell_size >= bx && bx + cell_size >= ax &&
+		az + cell_size >= bz && bz + cell_size >= az;
+}
+
+void SpatialHash::Build(const float * rover_x, const float * rover_z, size_t rover_count)
+{
+	x = rover_x;
+	z = rover_z;
+	count = rover_count;
+
+	size_t bucket_count = 16;
+	while (bucket_count < 2 * count)
+		bucket_count *= 2;
+	bucket_start.assign(bucket_count + 1, 0);
+
+	cell_x.resize(count);
+	cell_z.resize(count);
+	bucket.resize(count);
+	Run(phase_hash);
+
+	// Counting sort by bucket
+	for (size_t i = 0; i < count; ++i)
+		bucket_start[bucket[i] + 1]++;
+	for (size_t b = 0; b < bucket_count; ++b)
+		bucket_start[b + 1] += bucket_start[b];
+
+	bucket_fill.assign(bucket_start.begin(), bucket_start.end() - 1);
+	entries.resize(count);
+	for (size_t i = 0; i < count; ++i)
+		entries[bucket_fill[bucket[i]]++] = uint32_t(i);
+
+	sorted_x.resize(count);
+	sorted_z.resize(count);
+	sorted_cell_x.resize(count);
+	sorted_cell_z.resize(count);
+	for (size_t k = 0; k < count; ++k)
+	{
+		uint32_t i = entries[k];
+		sorted_x[k] = x[i];
+		sorted_z[k] = z[i];
+		sorted_cell_x[k] = cell_x[i];
+		sorted_cell_z[k] = cell_z[i];
+	}
+}
+
+void SpatialHash::FindPairs(std::vector<RoverPair>& pairs)
+{
+	Run(phase_pairs);
+
+	pairs.clear();
+	for (const auto& pairs_of_band : band_pairs)
+		pairs.insert(pairs.end(), pairs_of_band.begin(), pairs_of_band.end());
+}
+
+void SpatialHash::Query(float px, float pz, std::vector<uint32_t>& overlapping) const
+{
+	overlapping.clear();
+	if (count == 0)
+		return;
+
+	int32_t center_x = Cell(px), center_z = Cell(pz);
+	for (int32_t cz = center_z - 1; cz <= center_z + 1; ++cz)
+		for (int32_t cx = center_x - 1; cx <= center_x + 1; ++cx)
+		{
+			uint32_t b = Bucket(cx, cz);
+			for (uint32_t k = bucket_start[b]; k < bucket_start[b + 1]; ++k)
+				if (sorted_cell_x[k] == cx && sorted_cell_z[k] == cz && Overlap(px, pz, sorted_x[k], sorted_z[k]))
+					overlapping.push_back(entries[k]);
+		}
+}
+
+void SpatialHash::Run(int run_phase)
+{
+	size_t band_count = jobs != NULL && count >= min_parallel_count ? jobs->ThreadCount() : 1;
+	band_pairs.resize(band_count);
+	if (band_count == 1)
+	{
+		RunBand(run_phase, 0, 1);
+		return;
+	}
+
+	jobs->ParallelFor("Broadphase band", band_count, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t band = begin; band < end; ++band)
+			RunBand(run_phase, band, band_count);
+	});
+}
+
+void SpatialHash::RunBand(int run_phase, size_t band, size_t band_count)
+{
+	size_t begin = count * band / band_count, end = count * (band + 1) / band_count;
+
+	if (run_phase == phase_hash)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			cell_x[i] = Cell(x[i]);
+			cell_z[i] = Cell(z[i]);
+			bucket[i] = Bucket(cell_x[i], cell_z[i]);
+		}
+		return;
+	}
+
+	// Overlapping boxes are at most one cell apart. Each rover looks at the later rovers of its own cell and at
+	// the four neighbouring cells ahead of it, the other four find it in turn, so every pair comes up once.
+	// Checking the cell too skips rovers of other cells that landed in the same bucket.
+	static const int32_t neighbours[4][2] = { { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };
+
+	auto& pairs = band_pairs[band];
+	pairs.clear();
+	const auto add_pair = [&](uint32_t k, uint32_t l)
+	{
+		uint32_t i = entries[k], j = entries[l];
+		pairs.push_back({ std::min(i, j), std::max(i, j) });
+	};
+	for (size_t k = begin; k < end; ++k)
+	{
+		float kx = sorted_x[k], kz = sorted_z[k];
+		int32_t cx = sorted_cell_x[k], cz = sorted_cell_z[k];
+
+		uint32_t b = bucket[entries[k]];
+		for (uint32_t l = uint32_t(k) + 1; l < bucket_start[b + 1]; ++l)
+			if (sorted_cell_x[l] == cx && sorted_cell_z[l] == cz && Overlap(kx, kz, sorted_x[l], sorted_z[l]))
+				add_pair(uint32_t(k), l);
+
+		for (const auto& neighbour : neighbours)
+		{
+			int32_t nx = cx + neighbour[0], nz = cz + neighbour[1];
+			uint32_t nb = Bucket(nx, nz);
+			for (uint32_t l = bucket_start[nb]; l < bucket_start[nb + 1]; ++l)
+				if (sorted_cell_x[l] == nx && sorted_cell_z[l] == nz && Overlap(kx, kz, sorted_x[l], sorted_z[l]))
+					add_pair(uint32_t(k), l);
+		}
+	}
+}
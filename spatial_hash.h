@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct JobSystem;
+
+/* Spatial Hash Structs */
+
+struct RoverPair
+{
+	uint32_t a;
+	uint32_t b; // always greater than a
+};
+
+// Broadphase over the x/z plane the rovers drive in: a uniform grid of cell_size cells, hashed into a table
+// twice as large as the rover count, rebuilt with a counting sort every simulation step. Rovers are boxes of
+// size cell_size, so two that overlap always sit in the same or neighbouring cells. Given a job system, Build and
+// FindPairs split the rovers into one band per thread, which pays off from a few ten thousand rovers.
+struct SpatialHash
+{
+	float cell_size;
+
+	// Rovers sorted by bucket, the rovers of bucket b are entries[bucket_start[b] .. bucket_start[b + 1])
+	std::vector<uint32_t> bucket_start;
+	std::vector<uint32_t> bucket_fill;
+	std::vector<uint32_t> entries;
+
+	// Per rover, from the last Build
+	std::vector<int32_t> cell_x;
+	std::vector<int32_t> cell_z;
+	std::vector<uint32_t> bucket;
+
+	// The same in bucket order, so neighbours are scanned in contiguous memory
+	std::vector<float> sorted_x;
+	std::vector<float> sorted_z;
+	std::vector<int32_t> sorted_cell_x;
+	std::vector<int32_t> sorted_cell_z;
+
+	// Input of the running Build or FindPairs, for the band jobs
+	const float * x;
+	const float * z;
+	size_t count;
+	std::vector<std::vector<RoverPair>> band_pairs;
+
+	JobSystem * jobs; // NULL runs everything on the calling thread
+
+	SpatialHash(float cell_size, JobSystem * jobs = NULL);
+
+	void Build(const float * x, const float * z, size_t count);
+
+	// Every pair of rovers from the last Build whose boxes overlap, each pair once
+	void FindPairs(std::vector<RoverPair>& pairs);
+
+	// Rovers from the last Build whose boxes overlap a box of cell_size at (px, pz)
+	void Query(float px, float pz, std::vector<uint32_t>& overlapping) const;
+
+	// Runs "phase" on every band of rovers, as jobs or inline
+	void Run(int phase);
+	void RunBand(int phase, size_t band, size_t band_count);
+
+	int32_t Cell(float coordinate) const;
+	uint32_t Bucket(int32_t x, int32_t z) const;
+	bool Overlap(float ax, float az, float bx, float bz) const;
+};
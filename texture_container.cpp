@@ -0,0 +1,130 @@
+#include "texture_container.h"
+
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Mapped Texture Container */
+
+MappedTextureContainer::MappedTextureContainer()
+	: data(NULL), size(0), header(NULL), mips(NULL)
+{
+}
+
+MappedTextureContainer::~MappedTextureContainer()
+{
+	Close();
+}
+
+bool MappedTextureContainer::Open(const std::string& path)
+{
+	Close();
+
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat file_stat;
+	if (fstat(file, &file_stat) != 0 || file_stat.st_size < off_t(sizeof(TextureContainerHeader)))
+	{
+		close(file);
+		return false;
+	}
+
+	void * mapping = mmap(NULL, size_t(file_stat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (mapping == MAP_FAILED)
+	{
+		std::cout << "Error: Could not map texture container " << path << std::endl;
+		return false;
+	}
+
+	data = static_cast<const unsigned char *>(mapping);
+	size = size_t(file_stat.st_size);
+	header = reinterpret_cast<const TextureContainerHeader *>(data);
+
+	bool valid = header->magic == texture_container_magic && header->version == texture_container_version &&
+		header->mip_count > 0 && sizeof(TextureContainerHeader) + header->mip_count * sizeof(TextureContainerMip) <= size;
+
+	if (valid)
+	{
+		mips = reinterpret_cast<const TextureContainerMip *>(data + sizeof(TextureContainerHeader));
+		valid = mips[0].width == header->width && mips[0].height == header->height;
+		for (uint32_t level = 0; level < header->mip_count && valid; ++level)
+			valid = mips[level].offset + mips[level].size <= size &&
+				mips[level].size == CompressedMipSize(header->gl_internal_format, mips[level].width, mips[level].height);
+	}
+
+	if (!valid)
+	{
+		std::cout << "Error: Texture container " << path << " is malformed or from another version" << std::endl;
+		Close();
+		return false;
+	}
+
+	// Levels are uploaded front to back right after mapping. Each call takes a single advice value.
+	madvise(mapping, size, MADV_SEQUENTIAL);
+	madvise(mapping, size, MADV_WILLNEED);
+	return true;
+}
+
+void MappedTextureContainer::Close()
+{
+	if (data != NULL)
+		munmap(const_cast<unsigned char *>(data), size);
+
+	data = NULL;
+	size = 0;
+	header = NULL;
+	mips = NULL;
+}
+
+const unsigned char * MappedTextureContainer::MipData(uint32_t level) const
+{
+	return data + mips[level].offset;
+}
+
+/* Texture Container Functions */
+
+GLuint CreateTextureFromContainer(const MappedTextureContainer& container)
+{
+	auto format = container.header->gl_internal_format;
+	bool format_supported = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT && GLAD_GL_EXT_texture_compression_s3tc;
+	if (!format_supported)
+	{
+		std::cout << "Compressed texture format 0x" << std::hex << format << std::dec << " is not supported by this driver" << std::endl;
+		return NULL;
+	}
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	for (uint32_t level = 0; level < container.header->mip_count; ++level)
+	{
+		const auto& mip = container.mips[level];
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, mip.width, mip.height, 0, GLsizei(mip.size), container.MipData(level));
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, container.header->mip_count - 1);
+
+	return texture;
+}
+
+size_t CompressedMipSize(uint32_t gl_internal_format, uint32_t width, uint32_t height)
+{
+	// BC1 stores every 4x4 block in 8 bytes, partial blocks at the edges included
+	size_t blocks_x = (width + 3) / 4;
+	size_t blocks_y = (height + 3) / 4;
+	switch (gl_internal_format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		return blocks_x * blocks_y * 8;
+	default:
+		return 0;
+	}
+}
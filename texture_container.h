@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "glad/glad.h"
+
+/* Texture Container Format */
+
+// ".mtex" files hold a block-compressed texture with its whole mip chain precomputed:
+// a TextureContainerHeader, then one TextureContainerMip per level, then the level data,
+// each level starting on a 16 byte boundary. Written by cook_texture, read with mmap at startup.
+const uint32_t texture_container_magic = 0x5845544D; // "MTEX"
+const uint32_t texture_container_version = 1;
+
+struct TextureContainerHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t gl_internal_format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mip_count;
+};
+
+struct TextureContainerMip
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;
+	uint64_t size;
+};
+
+/* Mapped Texture Container */
+
+struct MappedTextureContainer
+{
+	const unsigned char * data;
+	size_t size;
+
+	const TextureContainerHeader * header;
+	const TextureContainerMip * mips;
+
+	MappedTextureContainer();
+	~MappedTextureContainer();
+
+	MappedTextureContainer(const MappedTextureContainer&) = delete;
+	MappedTextureContainer& operator=(const MappedTextureContainer&) = delete;
+
+	// Maps the file read-only and validates its header and mip table. False if missing or malformed.
+	bool Open(const std::string& path);
+	void Close();
+
+	const unsigned char * MipData(uint32_t level) const;
+};
+
+/* Texture Container Functions */
+
+// Uploads every level with glCompressedTexImage2D. Returns NULL if the driver lacks the format.
+GLuint CreateTextureFromContainer(const MappedTextureContainer& container);
+
+size_t CompressedMipSize(uint32_t gl_internal_format, uint32_t width, uint32_t height);
@@ -0,0 +1,320 @@
+#include "texture_cooking.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "texture_container.h"
+#include "virtual_texture.h"
+
+/* Cooking Helpers */
+
+namespace
+{
+	uint16_t PackRGB565(const int color[3])
+	{
+		return uint16_t(((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3));
+	}
+
+	void UnpackRGB565(uint16_t packed, int color[3])
+	{
+		// Replicate the high bits into the low ones, the same expansion the hardware does
+		int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	size_t AlignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	uint32_t NextPowerOfTwo(uint32_t value)
+	{
+		uint32_t result = 1;
+		while (result < value)
+			result *= 2;
+		return result;
+	}
+}
+
+/* Cooking Functions */
+
+RGBImage DownsampleImage(const RGBImage& image)
+{
+	RGBImage result;
+	result.width = std::max(1, image.width / 2);
+	result.height = std::max(1, image.height / 2);
+	result.pixels.resize(size_t(result.width) * result.height * 3);
+
+	for (int y = 0; y < result.height; ++y)
+		for (int x = 0; x < result.width; ++x)
+		{
+			// 2x2 footprint, clamped for odd or 1 pixel wide sources
+			int x0 = std::min(x * 2, image.width - 1), x1 = std::min(x * 2 + 1, image.width - 1);
+			int y0 = std::min(y * 2, image.height - 1), y1 = std::min(y * 2 + 1, image.height - 1);
+
+			for (int c = 0; c < 3; ++c)
+			{
+				int sum = image.pixels[(size_t(y0) * image.width + x0) * 3 + c] + image.pixels[(size_t(y0) * image.width + x1) * 3 + c] +
+					image.pixels[(size_t(y1) * image.width + x0) * 3 + c] + image.pixels[(size_t(y1) * image.width + x1) * 3 + c];
+				result.pixels[(size_t(y) * result.width + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+
+	return result;
+}
+
+RGBImage ResampleImage(const RGBImage& image, int width, int height)
+{
+	RGBImage result;
+	result.width = width;
+	result.height = height;
+	result.pixels.resize(size_t(width) * height * 3);
+
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			// Texel centers map onto texel centers, like GL_LINEAR with clamping
+			float sx = std::max(0.f, (x + 0.5f) * image.width / width - 0.5f);
+			float sy = std::max(0.f, (y + 0.5f) * image.height / height - 0.5f);
+			int x0 = std::min(int(sx), image.width - 1), x1 = std::min(x0 + 1, image.width - 1);
+			int y0 = std::min(int(sy), image.height - 1), y1 = std::min(y0 + 1, image.height - 1);
+			float fx = sx - x0, fy = sy - y0;
+
+			for (int c = 0; c < 3; ++c)
+			{
+				float top = image.pixels[(size_t(y0) * image.width + x0) * 3 + c] * (1 - fx) + image.pixels[(size_t(y0) * image.width + x1) * 3 + c] * fx;
+				float bottom = image.pixels[(size_t(y1) * image.width + x0) * 3 + c] * (1 - fx) + image.pixels[(size_t(y1) * image.width + x1) * 3 + c] * fx;
+				result.pixels[(size_t(y) * width + x) * 3 + c] = (unsigned char)(top * (1 - fy) + bottom * fy + 0.5f);
+			}
+		}
+
+	return result;
+}
+
+std::vector<RGBImage> GenerateMipChain(RGBImage image)
+{
+	std::vector<RGBImage> mips;
+	mips.push_back(std::move(image));
+	while (mips.back().width > 1 || mips.back().height > 1)
+		mips.push_back(DownsampleImage(mips.back()));
+	return mips;
+}
+
+void EncodeBC1Block(const unsigned char block[16 * 3], unsigned char output[8])
+{
+	// Endpoints from the bounding box of the block, inset slightly so they sit on the colors rather than beyond them
+	int min_color[3] = { 255, 255, 255 }, max_color[3] = { 0, 0, 0 };
+	int mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < 3; ++c)
+		{
+			min_color[c] = std::min(min_color[c], int(block[i * 3 + c]));
+			max_color[c] = std::max(max_color[c], int(block[i * 3 + c]));
+			mean[c] += block[i * 3 + c];
+		}
+
+	// The box has four diagonals, pick the one the colors actually spread along by
+	// flipping red and blue when they are anti-correlated with green
+	int covariance_rg = 0, covariance_bg = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int g = block[i * 3 + 1] * 16 - mean[1];
+		covariance_rg += (block[i * 3 + 0] * 16 - mean[0]) * g;
+		covariance_bg += (block[i * 3 + 2] * 16 - mean[2]) * g;
+	}
+	if (covariance_rg < 0)
+		std::swap(min_color[0], max_color[0]);
+	if (covariance_bg < 0)
+		std::swap(min_color[2], max_color[2]);
+
+	for (int c = 0; c < 3; ++c)
+	{
+		int inset = (max_color[c] - min_color[c]) / 16;
+		max_color[c] -= inset;
+		min_color[c] += inset;
+	}
+
+	uint16_t color_0 = PackRGB565(max_color);
+	uint16_t color_1 = PackRGB565(min_color);
+
+	// color_0 > color_1 selects the opaque four color mode
+	if (color_0 < color_1)
+		std::swap(color_0, color_1);
+
+	int palette[4][3];
+	UnpackRGB565(color_0, palette[0]);
+	UnpackRGB565(color_1, palette[1]);
+	for (int c = 0; c < 3; ++c)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+
+	uint32_t indices = 0;
+	if (color_0 != color_1)
+		for (int i = 0; i < 16; ++i)
+		{
+			int best_index = 0, best_distance = INT32_MAX;
+			for (int p = 0; p < 4; ++p)
+			{
+				int distance = 0;
+				for (int c = 0; c < 3; ++c)
+				{
+					int d = int(block[i * 3 + c]) - palette[p][c];
+					distance += d * d;
+				}
+				if (distance < best_distance)
+				{
+					best_distance = distance;
+					best_index = p;
+				}
+			}
+			indices |= uint32_t(best_index) << (i * 2);
+		}
+
+	output[0] = (unsigned char)(color_0 & 0xFF);
+	output[1] = (unsigned char)(color_0 >> 8);
+	output[2] = (unsigned char)(color_1 & 0xFF);
+	output[3] = (unsigned char)(color_1 >> 8);
+	output[4] = (unsigned char)(indices & 0xFF);
+	output[5] = (unsigned char)((indices >> 8) & 0xFF);
+	output[6] = (unsigned char)((indices >> 16) & 0xFF);
+	output[7] = (unsigned char)(indices >> 24);
+}
+
+std::vector<unsigned char> EncodeBC1(const RGBImage& image)
+{
+	int blocks_x = (image.width + 3) / 4;
+	int blocks_y = (image.height + 3) / 4;
+	std::vector<unsigned char> encoded(size_t(blocks_x) * blocks_y * 8);
+
+	unsigned char block[16 * 3];
+	for (int by = 0; by < blocks_y; ++by)
+		for (int bx = 0; bx < blocks_x; ++bx)
+		{
+			for (int y = 0; y < 4; ++y)
+				for (int x = 0; x < 4; ++x)
+				{
+					int sx = std::min(bx * 4 + x, image.width - 1);
+					int sy = std::min(by * 4 + y, image.height - 1);
+					for (int c = 0; c < 3; ++c)
+						block[(y * 4 + x) * 3 + c] = image.pixels[(size_t(sy) * image.width + sx) * 3 + c];
+				}
+
+			EncodeBC1Block(block, &encoded[(size_t(by) * blocks_x + bx) * 8]);
+		}
+
+	return encoded;
+}
+
+bool WriteTextureContainer(const std::string& path, const std::vector<RGBImage>& mips)
+{
+	TextureContainerHeader header;
+	header.magic = texture_container_magic;
+	header.version = texture_container_version;
+	header.gl_internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	header.width = mips[0].width;
+	header.height = mips[0].height;
+	header.mip_count = uint32_t(mips.size());
+
+	std::vector<TextureContainerMip> table(mips.size());
+	std::vector<std::vector<unsigned char>> levels(mips.size());
+
+	size_t offset = AlignUp(sizeof(header) + sizeof(TextureContainerMip) * mips.size(), 16);
+	for (size_t level = 0; level < mips.size(); ++level)
+	{
+		levels[level] = EncodeBC1(mips[level]);
+
+		table[level].width = mips[level].width;
+		table[level].height = mips[level].height;
+		table[level].offset = offset;
+		table[level].size = levels[level].size();
+		offset = AlignUp(offset + levels[level].size(), 16);
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "Error: Could not open " << path << " for writing" << std::endl;
+		return false;
+	}
+
+	const char padding[16] = {};
+	file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char *>(table.data()), sizeof(TextureContainerMip) * table.size());
+	for (size_t level = 0; level < mips.size(); ++level)
+	{
+		file.write(padding, std::streamsize(table[level].offset - size_t(file.tellp())));
+		file.write(reinterpret_cast<const char *>(levels[level].data()), levels[level].size());
+	}
+
+	return bool(file);
+}
+
+bool WriteVirtualTextureFile(const std::string& path, const RGBImage& image, int page_size, int page_border)
+{
+	VirtualTextureHeader header;
+	header.magic = virtual_texture_magic;
+	header.version = virtual_texture_version;
+	header.pages_x = NextPowerOfTwo(uint32_t((image.width + page_size - 1) / page_size));
+	header.pages_y = NextPowerOfTwo(uint32_t((image.height + page_size - 1) / page_size));
+	header.page_size = page_size;
+	header.page_border = page_border;
+	header.mip_count = 1;
+	while ((header.pages_x >> header.mip_count) > 0 || (header.pages_y >> header.mip_count) > 0)
+		header.mip_count++;
+	header.reserved = 0;
+
+	if (header.pages_x > 4096 || header.pages_y > 4096)
+	{
+		std::cout << "Error: " << path << " would need more than 4096 pages per side" << std::endl;
+		return false;
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "Error: Could not open " << path << " for writing" << std::endl;
+		return false;
+	}
+	file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+	int slot_size = page_size + 2 * page_border;
+	std::vector<unsigned char> page(size_t(slot_size) * slot_size * 3);
+
+	RGBImage level;
+	for (uint32_t mip = 0; mip < header.mip_count; ++mip)
+	{
+		int pages_x = int(std::max(1u, header.pages_x >> mip));
+		int pages_y = int(std::max(1u, header.pages_y >> mip));
+		int width = pages_x * page_size, height = pages_y * page_size;
+
+		// Halve while both sides still halve, once one side is down to a single page resample instead
+		if (mip == 0)
+			level = ResampleImage(image, width, height);
+		else if (level.width == width * 2 && level.height == height * 2)
+			level = DownsampleImage(level);
+		else
+			level = ResampleImage(level, width, height);
+
+		for (int py = 0; py < pages_y; ++py)
+			for (int px = 0; px < pages_x; ++px)
+			{
+				for (int y = 0; y < slot_size; ++y)
+					for (int x = 0; x < slot_size; ++x)
+					{
+						int sx = std::min(std::max(px * page_size - page_border + x, 0), width - 1);
+						int sy = std::min(std::max(py * page_size - page_border + y, 0), height - 1);
+						for (int c = 0; c < 3; ++c)
+							page[(size_t(y) * slot_size + x) * 3 + c] = level.pixels[(size_t(sy) * width + sx) * 3 + c];
+					}
+
+				file.write(reinterpret_cast<const char *>(page.data()), page.size());
+			}
+	}
+
+	return bool(file);
+}
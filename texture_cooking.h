@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Image Structs */
+
+// Tightly packed 8 bit RGB, rows bottom to top like the textures uploaded in main.cpp
+struct RGBImage
+{
+	int width;
+	int height;
+	std::vector<unsigned char> pixels;
+};
+
+/* Cooking Functions */
+
+// Box-filters "image" down to half size (rounding down, never below 1x1)
+RGBImage DownsampleImage(const RGBImage& image);
+
+// Bilinear resize to exactly width x height
+RGBImage ResampleImage(const RGBImage& image, int width, int height);
+
+// Level 0 is "image" itself, the last level is 1x1
+std::vector<RGBImage> GenerateMipChain(RGBImage image);
+
+// Encodes a single 4x4 block of RGB texels (row-major, 3 bytes each) into 8 bytes of BC1
+void EncodeBC1Block(const unsigned char block[16 * 3], unsigned char output[8]);
+
+// Encodes a whole image, edge blocks are padded by clamping to the last row/column
+std::vector<unsigned char> EncodeBC1(const RGBImage& image);
+
+// Writes the mip chain as a BC1 .mtex container (see texture_container.h)
+bool WriteTextureContainer(const std::string& path, const std::vector<RGBImage>& mips);
+
+// Writes "image" as a tiled .vtex pyramid (see virtual_texture.h). The image is resampled so
+// both page counts are powers of two, every mip is cut into bordered pages.
+bool WriteVirtualTextureFile(const std::string& path, const RGBImage& image, int page_size = 128, int page_border = 4);
@@ -0,0 +1,174 @@
+#include "texture_residency.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "texture_container.h"
+
+/* Texture Residency Manager */
+
+TextureResidencyManager::TextureResidencyManager(size_t budget_bytes, size_t reload_bytes_per_frame)
+	: budget_bytes(budget_bytes), reload_bytes_per_frame(reload_bytes_per_frame)
+{
+}
+
+void TextureResidencyManager::Register(GLuint texture, int width, int height, int mip_count, GLenum internal_format, GLenum format, GLenum type,
+	MipLevelReader read_level, std::function<void()> release_source)
+{
+	ResidentTexture entry;
+	entry.texture = texture;
+	entry.width = width;
+	entry.height = height;
+	entry.mip_count = mip_count;
+	entry.internal_format = internal_format;
+	entry.format = format;
+	entry.type = type;
+	entry.compressed = false;
+	entry.read_level = read_level;
+	entry.release_source = release_source;
+	entry.resident_base = 0;
+	entry.wanted_base = 0;
+
+	// Drivers pad 3 channel formats to 4 bytes per texel, so that is what counts against VRAM
+	for (int level = 0; level < mip_count; ++level)
+		entry.level_bytes.push_back(size_t(std::max(1, width >> level)) * std::max(1, height >> level) * 4);
+
+	textures.push_back(entry);
+}
+
+void TextureResidencyManager::RegisterCompressed(GLuint texture, int width, int height, int mip_count, GLenum internal_format,
+	MipLevelReader read_level, std::function<void()> release_source)
+{
+	Register(texture, width, height, mip_count, internal_format, GL_NONE, GL_NONE, read_level, release_source);
+
+	auto& entry = textures.back();
+	entry.compressed = true;
+	for (int level = 0; level < mip_count; ++level)
+		entry.level_bytes[level] = CompressedMipSize(internal_format, std::max(1, width >> level), std::max(1, height >> level));
+}
+
+void TextureResidencyManager::BeginFrame()
+{
+	// Textures nobody looks at this frame only need their coarsest level
+	for (auto& entry : textures)
+		entry.wanted_base = entry.mip_count - 1;
+}
+
+void TextureResidencyManager::RecordUse(GLuint texture, float world_texel_size, float distance, float fov_y_radians, int screen_height)
+{
+	float pixel_world_size = 2.f * distance * std::tan(fov_y_radians / 2.f) / float(std::max(1, screen_height));
+
+	for (auto& entry : textures)
+		if (entry.texture == texture)
+			entry.wanted_base = std::min(entry.wanted_base, EstimateFinestMip(world_texel_size, pixel_world_size, entry.mip_count));
+}
+
+void TextureResidencyManager::Update()
+{
+	/* Over budget: drop levels nobody samples first, then needed ones, always from the texture with the biggest top level */
+	size_t resident = ResidentBytes();
+	for (int pass = 0; pass < 2 && resident > budget_bytes; ++pass)
+		while (resident > budget_bytes)
+		{
+			ResidentTexture * victim = NULL;
+			for (auto& entry : textures)
+			{
+				bool evictable = entry.read_level && entry.resident_base < entry.mip_count - 1 && (pass == 1 || entry.resident_base < entry.wanted_base);
+				if (evictable && (victim == NULL || entry.level_bytes[entry.resident_base] > victim->level_bytes[victim->resident_base]))
+					victim = &entry;
+			}
+			if (victim == NULL)
+				break;
+
+			resident -= victim->level_bytes[victim->resident_base];
+			Evict(*victim, victim->resident_base + 1);
+		}
+
+	/* Room left: bring back wanted levels, coarse to fine, within the per-frame upload allowance */
+	size_t reloaded = 0;
+	for (auto& entry : textures)
+	{
+		while (entry.resident_base > entry.wanted_base && reloaded < reload_bytes_per_frame)
+		{
+			int level = entry.resident_base - 1;
+			if (resident + entry.level_bytes[level] > budget_bytes || !Reload(entry, level))
+				break;
+
+			resident += entry.level_bytes[level];
+			reloaded += entry.level_bytes[level];
+		}
+
+		if (entry.resident_base <= entry.wanted_base && entry.release_source)
+			entry.release_source();
+	}
+}
+
+size_t TextureResidencyManager::ResidentBytes() const
+{
+	size_t total = 0;
+	for (const auto& entry : textures)
+		total += ResidentBytes(entry, entry.resident_base);
+	return total;
+}
+
+size_t TextureResidencyManager::ResidentBytes(const ResidentTexture& entry, int base) const
+{
+	size_t total = 0;
+	for (int level = base; level < entry.mip_count; ++level)
+		total += entry.level_bytes[level];
+	return total;
+}
+
+void TextureResidencyManager::Evict(ResidentTexture& entry, int new_base)
+{
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+	glBindTexture(GL_TEXTURE_2D, entry.texture);
+
+	// Clamp sampling first so the texture stays complete, then give the storage back with a 0x0 respecification
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, new_base);
+	for (int level = entry.resident_base; level < new_base; ++level)
+		glTexImage2D(GL_TEXTURE_2D, level, entry.internal_format, 0, 0, 0,
+			entry.compressed ? GL_RGB : entry.format, entry.compressed ? GL_UNSIGNED_BYTE : entry.type, NULL);
+
+	entry.resident_base = new_base;
+	glBindTexture(GL_TEXTURE_2D, previous_texture);
+}
+
+bool TextureResidencyManager::Reload(ResidentTexture& entry, int level)
+{
+	std::vector<unsigned char> data;
+	if (!entry.read_level(level, data))
+		return false;
+
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+	glBindTexture(GL_TEXTURE_2D, entry.texture);
+
+	int width = std::max(1, entry.width >> level), height = std::max(1, entry.height >> level);
+	if (entry.compressed)
+	{
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, entry.internal_format, width, height, 0, GLsizei(data.size()), data.data());
+	}
+	else
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, level, entry.internal_format, width, height, 0, entry.format, entry.type, data.data());
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+
+	entry.resident_base = level;
+	glBindTexture(GL_TEXTURE_2D, previous_texture);
+	return true;
+}
+
+/* Texture Residency Functions */
+
+int EstimateFinestMip(float world_texel_size, float pixel_world_size, int mip_count)
+{
+	// One level coarser for every doubling of texels per pixel
+	float texels_per_pixel = pixel_world_size / std::max(world_texel_size, 1e-12f);
+	int mip = texels_per_pixel > 1.f ? int(std::floor(std::log2(texels_per_pixel))) : 0;
+	return std::min(mip, mip_count - 1);
+}
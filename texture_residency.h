@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "glad/glad.h"
+
+/* Texture Residency Structs */
+
+// Fills "data" with one level in the texture's upload layout, false while the data is not available yet
+typedef std::function<bool(int level, std::vector<unsigned char>& data)> MipLevelReader;
+
+struct ResidentTexture
+{
+	GLuint texture;
+	int width;
+	int height;
+	int mip_count;
+
+	// Either a compressed format, uploaded with glCompressedTexImage2D, or an uncompressed one with format/type
+	GLenum internal_format;
+	GLenum format;
+	GLenum type;
+	bool compressed;
+
+	std::vector<size_t> level_bytes;
+
+	MipLevelReader read_level;
+	std::function<void()> release_source;
+
+	// Finest level with storage on the GPU (GL_TEXTURE_BASE_LEVEL) and finest level sampled this frame
+	int resident_base;
+	int wanted_base;
+};
+
+// Keeps the sum of all registered textures' resident mips under a VRAM budget.
+// Every frame callers report how each texture is seen; the finest mip that is
+// actually sampled follows from the on-screen size of one texel. Levels finer than that are the
+// first to be evicted when over budget, and needed levels are reloaded when there is room.
+struct TextureResidencyManager
+{
+	size_t budget_bytes;
+	size_t reload_bytes_per_frame;
+
+	std::vector<ResidentTexture> textures;
+
+	TextureResidencyManager(size_t budget_bytes, size_t reload_bytes_per_frame = 8 << 20);
+
+	// The texture must have all "mip_count" levels resident when registered
+	void Register(GLuint texture, int width, int height, int mip_count, GLenum internal_format, GLenum format, GLenum type,
+		MipLevelReader read_level, std::function<void()> release_source = std::function<void()>());
+	void RegisterCompressed(GLuint texture, int width, int height, int mip_count, GLenum internal_format,
+		MipLevelReader read_level, std::function<void()> release_source = std::function<void()>());
+
+	void BeginFrame();
+
+	// world_texel_size: world-space size of one level 0 texel on the object
+	// distance: distance from the camera to the nearest visible point of the object
+	void RecordUse(GLuint texture, float world_texel_size, float distance, float fov_y_radians, int screen_height);
+
+	// Evicts or reloads levels so the resident total fits budget_bytes
+	void Update();
+
+	size_t ResidentBytes() const;
+	size_t ResidentBytes(const ResidentTexture& entry, int base) const;
+
+	void Evict(ResidentTexture& entry, int new_base);
+	bool Reload(ResidentTexture& entry, int level);
+};
+
+/* Texture Residency Functions */
+
+// Finest mip a sampler picks when one screen pixel covers "pixel_world_size" and one texel "world_texel_size"
+int EstimateFinestMip(float world_texel_size, float pixel_world_size, int mip_count);
@@ -0,0 +1,318 @@
+#include "texture_streaming.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "cpu_profiler.h"
+#include "stb_image.h"
+
+/* Texture Streamer */
+
+TextureStreamer::TextureStreamer(int worker_count, size_t upload_budget)
+	: upload_budget(upload_budget), next_upload_buffer(0), stopping(false)
+{
+	upload_buffers.resize(3);
+	upload_buffer_sizes.assign(upload_buffers.size(), upload_budget);
+	glGenBuffers(GLsizei(upload_buffers.size()), upload_buffers.data());
+	for (auto buffer : upload_buffers)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, upload_budget, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	for (int i = 0; i < worker_count; ++i)
+		workers.emplace_back(&TextureStreamer::WorkerLoop, this);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work_available.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+
+	// No GL calls here: main.cpp destroys the context before its locals go out of scope,
+	// and the upload buffers go away with it
+}
+
+GLuint TextureStreamer::Request(const std::string& path, uint32_t placeholder_color)
+{
+	StreamedTexture entry;
+	entry.path = path;
+	entry.failed = false;
+	entry.upload_level = -1;
+	entry.upload_row = 0;
+	entry.resident_base_level = -1;
+	entry.requested = std::chrono::steady_clock::now();
+	entry.upload_frames = 0;
+	entry.reload_pending = false;
+
+	const unsigned char placeholder[3] = {
+		(unsigned char)(placeholder_color >> 16), (unsigned char)(placeholder_color >> 8), (unsigned char)placeholder_color
+	};
+
+	glGenTextures(1, &entry.texture);
+	glBindTexture(GL_TEXTURE_2D, entry.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, placeholder);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+	textures.push_back(entry);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		decode_queue.emplace_back(textures.size() - 1, path);
+	}
+	work_available.notify_one();
+
+	return entry.texture;
+}
+
+void TextureStreamer::Update()
+{
+	// Re-specify textures whose decode finished: allocate every level, nothing resident yet
+	std::vector<std::pair<size_t, std::vector<RGBImage>>> finished;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		finished.swap(decoded);
+	}
+
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+
+	for (auto& result : finished)
+	{
+		auto& entry = textures[result.first];
+		if (entry.reload_pending)
+		{
+			entry.reload_mips = std::move(result.second);
+			entry.reload_pending = false;
+
+			// The file went away or changed under us, stop asking for it every frame
+			if (entry.reload_mips.empty())
+			{
+				std::cout << "Error: Texture " << entry.path << " could not be decoded again for residency" << std::endl;
+				entry.failed = true;
+			}
+			continue;
+		}
+
+		entry.mips = std::move(result.second);
+		if (entry.mips.empty())
+		{
+			entry.failed = true;
+			continue;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, entry.texture);
+		for (size_t level = 0; level < entry.mips.size(); ++level)
+			glTexImage2D(GL_TEXTURE_2D, GLint(level), GL_RGB8, entry.mips[level].width, entry.mips[level].height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+		entry.upload_level = int(entry.mips.size()) - 1;
+		entry.upload_row = 0;
+		entry.resident_base_level = int(entry.mips.size());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry.upload_level);
+	}
+
+	/* Gather this frame's slices, coarsest levels first so every texture sharpens evenly */
+	struct Slice
+	{
+		size_t texture_index;
+		int level;
+		int first_row;
+		int row_count;
+		size_t offset;
+	};
+	std::vector<Slice> slices;
+	size_t used = 0;
+
+	for (size_t t = 0; t < textures.size() && used < upload_budget; ++t)
+	{
+		auto& entry = textures[t];
+		int level = entry.upload_level;
+		int row = entry.upload_row;
+		while (level >= 0 && used < upload_budget)
+		{
+			const auto& mip = entry.mips[level];
+			size_t row_bytes = size_t(mip.width) * 3;
+			int rows = int(std::min<size_t>(mip.height - row, (upload_budget - used) / row_bytes));
+
+			// A row larger than the whole budget still goes through alone, or the texture would never finish
+			if (rows == 0 && used == 0)
+				rows = 1;
+			if (rows == 0)
+				break;
+
+			slices.push_back({ t, level, row, rows, used });
+			used += rows * row_bytes;
+
+			row += rows;
+			if (row == mip.height)
+			{
+				level--;
+				row = 0;
+			}
+		}
+	}
+
+	if (!slices.empty())
+	{
+		GLuint buffer = upload_buffers[next_upload_buffer];
+		size_t& buffer_size = upload_buffer_sizes[next_upload_buffer];
+		next_upload_buffer = (next_upload_buffer + 1) % upload_buffers.size();
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		if (used > buffer_size)
+		{
+			buffer_size = used;
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer_size, NULL, GL_STREAM_DRAW);
+		}
+		auto mapped = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, used, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+		for (const auto& slice : slices)
+		{
+			const auto& mip = textures[slice.texture_index].mips[slice.level];
+			size_t row_bytes = size_t(mip.width) * 3;
+			std::memcpy(mapped + slice.offset, &mip.pixels[slice.first_row * row_bytes], slice.row_count * row_bytes);
+		}
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (const auto& slice : slices)
+		{
+			auto& entry = textures[slice.texture_index];
+			auto& mip = entry.mips[slice.level];
+
+			glBindTexture(GL_TEXTURE_2D, entry.texture);
+			glTexSubImage2D(GL_TEXTURE_2D, slice.level, 0, slice.first_row, mip.width, slice.row_count,
+				GL_RGB, GL_UNSIGNED_BYTE, reinterpret_cast<const void *>(slice.offset));
+
+			entry.upload_row = slice.first_row + slice.row_count;
+			if (entry.upload_row < mip.height)
+				continue;
+
+			// Level done: let sampling use it and give its memory back
+			entry.resident_base_level = slice.level;
+			entry.upload_level = slice.level - 1;
+			entry.upload_row = 0;
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, slice.level);
+			mip.pixels.clear();
+			mip.pixels.shrink_to_fit();
+
+			if (slice.level == 0)
+			{
+				auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - entry.requested).count();
+				std::cout << "Texture " << entry.path << " fully streamed, X:" << mip.width << " Y:" << mip.height
+					<< " in " << milliseconds << " ms over " << entry.upload_frames + 1 << " upload frames" << std::endl;
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		for (size_t t = 0; t < textures.size(); ++t)
+			if (std::any_of(slices.begin(), slices.end(), [t](const Slice& slice) { return slice.texture_index == t; }))
+				textures[t].upload_frames++;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, previous_texture);
+}
+
+bool TextureStreamer::IsComplete(GLuint texture) const
+{
+	for (const auto& entry : textures)
+		if (entry.texture == texture)
+			return entry.failed || entry.resident_base_level == 0;
+	return false;
+}
+
+bool TextureStreamer::AllComplete() const
+{
+	for (const auto& entry : textures)
+		if (!entry.failed && entry.resident_base_level != 0)
+			return false;
+	return true;
+}
+
+bool TextureStreamer::ReadLevel(GLuint texture, int level, std::vector<unsigned char>& data)
+{
+	for (auto& entry : textures)
+	{
+		if (entry.texture != texture || entry.failed || entry.resident_base_level != 0)
+			continue;
+
+		if (!entry.reload_mips.empty())
+		{
+			if (level >= int(entry.reload_mips.size()))
+				return false;
+			data = entry.reload_mips[level].pixels;
+			return true;
+		}
+
+		if (!entry.reload_pending)
+		{
+			entry.reload_pending = true;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				decode_queue.emplace_back(&entry - textures.data(), entry.path);
+			}
+			work_available.notify_one();
+		}
+		return false;
+	}
+	return false;
+}
+
+void TextureStreamer::ReleaseLevels(GLuint texture)
+{
+	for (auto& entry : textures)
+		if (entry.texture == texture && !entry.reload_mips.empty())
+		{
+			entry.reload_mips.clear();
+			entry.reload_mips.shrink_to_fit();
+		}
+}
+
+void TextureStreamer::WorkerLoop()
+{
+	PROFILE_THREAD_NAME("Texture decode");
+	for (;;)
+	{
+		size_t index;
+		std::string path;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_available.wait(lock, [this] { return stopping || !decode_queue.empty(); });
+			if (stopping)
+				return;
+
+			// Only the queue is shared, "textures" belongs to the GL thread
+			index = decode_queue.front().first;
+			path = decode_queue.front().second;
+			decode_queue.pop_front();
+		}
+
+		PROFILE_ZONE("Decode texture");
+		std::vector<RGBImage> mips;
+
+		RGBImage image;
+		int channels;
+		unsigned char * data = stbi_load(path.c_str(), &image.width, &image.height, &channels, 3);
+		if (data == NULL)
+		{
+			std::cout << "Texture " << path << " failed to load." << std::endl;
+			std::cout << "Error: " << stbi_failure_reason() << std::endl;
+		}
+		else
+		{
+			image.pixels.assign(data, data + size_t(image.width) * image.height * 3);
+			stbi_image_free(data);
+			mips = GenerateMipChain(std::move(image));
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		decoded.emplace_back(index, std::move(mips));
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glad/glad.h"
+#include "texture_cooking.h"
+
+/* Texture Streaming Structs */
+
+struct StreamedTexture
+{
+	std::string path;
+	GLuint texture;
+	bool failed;
+
+	// Empty until a worker has decoded the image, levels are released once uploaded
+	std::vector<RGBImage> mips;
+
+	// Upload cursor, runs from the coarsest level to level 0, row by row
+	int upload_level;
+	int upload_row;
+
+	// Finest level that is completely uploaded, the texture's GL_TEXTURE_BASE_LEVEL
+	int resident_base_level;
+
+	std::chrono::steady_clock::time_point requested;
+	int upload_frames;
+
+	// Decoded again on demand after the texture is complete, for levels that were evicted and are needed back
+	std::vector<RGBImage> reload_mips;
+	bool reload_pending;
+};
+
+// Decodes textures on worker threads and uploads them through pixel buffer objects in
+// bounded slices per frame. A requested texture is usable right away: it starts as a 1x1
+// placeholder and refines from its smallest mip towards level 0 as data arrives.
+struct TextureStreamer
+{
+	size_t upload_budget;
+
+	std::vector<StreamedTexture> textures;
+
+	// Pixel unpack buffers used round-robin so a new frame's slices never wait on the last ones. They grow past
+	// upload_budget for a single row that is larger on its own.
+	std::vector<GLuint> upload_buffers;
+	std::vector<size_t> upload_buffer_sizes;
+	size_t next_upload_buffer;
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::deque<std::pair<size_t, std::string>> decode_queue;
+	std::vector<std::pair<size_t, std::vector<RGBImage>>> decoded;
+	bool stopping;
+
+	TextureStreamer(int worker_count = 2, size_t upload_budget = 4 << 20);
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// Creates the texture with a flat placeholder color (0xRRGGBB) and queues its decode
+	GLuint Request(const std::string& path, uint32_t placeholder_color = 0x808080);
+
+	// Call once per frame on the GL thread: picks up decoded images and uploads at most upload_budget bytes
+	void Update();
+
+	bool IsComplete(GLuint texture) const;
+	bool AllComplete() const;
+
+	// Source for TextureResidencyManager: copies one level of a completed texture, queueing a fresh
+	// decode and returning false the first time. ReleaseLevels drops the decoded copy again.
+	bool ReadLevel(GLuint texture, int level, std::vector<unsigned char>& data);
+	void ReleaseLevels(GLuint texture);
+
+	void WorkerLoop();
+};
@@ -0,0 +1,430 @@
+#include "virtual_texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cpu_profiler.h"
+
+/* Virtual Texture */
+
+VirtualTexture::VirtualTexture()
+	: file(-1), page_bytes(0), slot_size(0), page_table_texture(0), atlas_texture(0), atlas_slots(0),
+	page_table_dirty(false), feedback_framebuffer(0), feedback_color(0), feedback_depth(0), feedback_scale(8),
+	feedback_width(0), feedback_height(0), feedback_next(0), uploads_per_frame(16), frame(0), stopping(false)
+{
+}
+
+VirtualTexture::~VirtualTexture()
+{
+	if (loader.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work_available.notify_all();
+		loader.join();
+	}
+
+	// GL objects go away with the context, main.cpp tears it down before locals are destroyed
+	if (file >= 0)
+		close(file);
+}
+
+bool VirtualTexture::Open(const std::string& path, int atlas_size, int feedback_scale, int uploads_per_frame)
+{
+	file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	// Page coordinates are packed in 12 bits, and the mip chain has to end in the single root page
+	// RebuildPageTable falls back to, so page counts are powers of two up to 4096 with a full chain
+	bool valid = pread(file, &header, sizeof(header), 0) == ssize_t(sizeof(header)) &&
+		header.magic == virtual_texture_magic && header.version == virtual_texture_version &&
+		header.pages_x != 0 && header.pages_y != 0 && header.pages_x <= 4096 && header.pages_y <= 4096 &&
+		(header.pages_x & (header.pages_x - 1)) == 0 && (header.pages_y & (header.pages_y - 1)) == 0;
+	if (valid)
+	{
+		uint32_t max_pages = std::max(header.pages_x, header.pages_y);
+		uint32_t full_chain = 1;
+		while ((1u << (full_chain - 1)) < max_pages)
+			++full_chain;
+		valid = header.mip_count == full_chain;
+	}
+	if (!valid)
+	{
+		std::cout << "Error: Virtual texture " << path << " is malformed or from another version" << std::endl;
+		close(file);
+		file = -1;
+		return false;
+	}
+
+	this->feedback_scale = feedback_scale;
+	this->uploads_per_frame = uploads_per_frame;
+
+	slot_size = int(header.page_size + 2 * header.page_border);
+	page_bytes = size_t(slot_size) * slot_size * 3;
+
+	mip_first_page.resize(header.mip_count);
+	uint64_t first_page = 0;
+	for (uint32_t mip = 0; mip < header.mip_count; ++mip)
+	{
+		mip_first_page[mip] = first_page;
+		first_page += uint64_t(PagesX(mip)) * PagesY(mip);
+	}
+
+	/* Physical page atlas, slot coordinates must fit the 8 bit page table channels */
+	atlas_slots = std::min(atlas_size / slot_size, 256);
+	slot_pages.assign(size_t(atlas_slots) * atlas_slots, UINT32_MAX);
+	slot_last_used.assign(slot_pages.size(), 0);
+
+	glGenTextures(1, &atlas_texture);
+	glBindTexture(GL_TEXTURE_2D, atlas_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, atlas_slots * slot_size, atlas_slots * slot_size, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+	/* Page table, one mip per virtual mip and one texel per page */
+	page_table.resize(header.mip_count);
+	glGenTextures(1, &page_table_texture);
+	glBindTexture(GL_TEXTURE_2D, page_table_texture);
+	for (uint32_t mip = 0; mip < header.mip_count; ++mip)
+	{
+		page_table[mip].assign(size_t(PagesX(mip)) * PagesY(mip), 0);
+		glTexImage2D(GL_TEXTURE_2D, mip, GL_RGBA8, PagesX(mip), PagesY(mip), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.mip_count - 1);
+
+	/* The single page of the coarsest mip is loaded now and never evicted, every lookup can fall back to it */
+	uint32_t root = PageKey(header.mip_count - 1, 0, 0);
+	std::vector<unsigned char> root_data;
+	if (!ReadPage(root, root_data))
+	{
+		std::cout << "Error: Virtual texture " << path << " is truncated" << std::endl;
+		glDeleteTextures(1, &page_table_texture);
+		glDeleteTextures(1, &atlas_texture);
+		page_table_texture = atlas_texture = 0;
+		close(file);
+		file = -1;
+		return false;
+	}
+	UploadPage(root, root_data.data());
+	slot_last_used[resident[root]] = UINT64_MAX;
+	RebuildPageTable();
+
+	feedback_buffers.resize(3);
+	glGenBuffers(GLsizei(feedback_buffers.size()), feedback_buffers.data());
+	feedback_fences.assign(feedback_buffers.size(), (GLsync)NULL);
+	feedback_counts.assign(feedback_buffers.size(), 0);
+
+	loader = std::thread(&VirtualTexture::LoaderLoop, this);
+
+	std::cout << "Virtual texture " << path << " is open, " << PagesX(0) * header.page_size << "x" << PagesY(0) * header.page_size
+		<< " texels in " << header.mip_count << " mips, atlas of " << atlas_slots * atlas_slots << " pages" << std::endl;
+	return true;
+}
+
+void VirtualTexture::SetupProgram(GLuint program, bool feedback) const
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "u_page_table"), page_table_unit);
+	glUniform1i(glGetUniformLocation(program, "u_page_atlas"), atlas_unit);
+	glUniform2f(glGetUniformLocation(program, "u_vt_pages"), float(PagesX(0)), float(PagesY(0)));
+	glUniform1f(glGetUniformLocation(program, "u_vt_mip_count"), float(header.mip_count));
+	glUniform1f(glGetUniformLocation(program, "u_vt_page_size"), float(header.page_size));
+	glUniform1f(glGetUniformLocation(program, "u_vt_page_border"), float(header.page_border));
+	glUniform1f(glGetUniformLocation(program, "u_vt_atlas_size"), float(atlas_slots * slot_size));
+
+	// The feedback target is feedback_scale times smaller, so its derivatives pick mips that much too coarse
+	glUniform1f(glGetUniformLocation(program, "u_vt_mip_bias"), feedback ? -std::log2(float(feedback_scale)) : 0.f);
+}
+
+void VirtualTexture::Bind() const
+{
+	glActiveTexture(GL_TEXTURE0 + page_table_unit);
+	glBindTexture(GL_TEXTURE_2D, page_table_texture);
+	glActiveTexture(GL_TEXTURE0 + atlas_unit);
+	glBindTexture(GL_TEXTURE_2D, atlas_texture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void VirtualTexture::BeginFeedback(int screen_width, int screen_height)
+{
+	int width = std::max(1, screen_width / feedback_scale);
+	int height = std::max(1, screen_height / feedback_scale);
+
+	if (feedback_framebuffer == 0)
+	{
+		glGenFramebuffers(1, &feedback_framebuffer);
+		glGenRenderbuffers(1, &feedback_color);
+		glGenRenderbuffers(1, &feedback_depth);
+	}
+
+	// The scene may be drawing into its own framebuffer, EndFeedback goes back to it
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &saved_framebuffer);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, feedback_framebuffer);
+	if (width != feedback_width || height != feedback_height)
+	{
+		feedback_width = width;
+		feedback_height = height;
+
+		glBindRenderbuffer(GL_RENDERBUFFER, feedback_color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, feedback_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedback_color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedback_depth);
+	}
+
+	glGetIntegerv(GL_VIEWPORT, saved_viewport);
+	glViewport(0, 0, width, height);
+
+	// All ones means "no page wanted"
+	const GLuint no_page[4] = { UINT32_MAX, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, no_page);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTexture::EndFeedback()
+{
+	size_t index = feedback_next;
+	feedback_next = (feedback_next + 1) % feedback_buffers.size();
+
+	// Still unread after a full trip around the ring: drop it rather than wait
+	if (feedback_fences[index] != NULL)
+		glDeleteSync(feedback_fences[index]);
+
+	feedback_counts[index] = size_t(feedback_width) * feedback_height;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedback_buffers[index]);
+	glBufferData(GL_PIXEL_PACK_BUFFER, feedback_counts[index] * sizeof(uint32_t), NULL, GL_STREAM_READ);
+	glReadPixels(0, 0, feedback_width, feedback_height, GL_RED_INTEGER, GL_UNSIGNED_INT, static_cast<void *>(0));
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	feedback_fences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, saved_framebuffer);
+	glViewport(saved_viewport[0], saved_viewport[1], saved_viewport[2], saved_viewport[3]);
+}
+
+void VirtualTexture::Update()
+{
+	frame++;
+
+	/* Consume every readback the GPU has finished, never waiting for one that is not */
+	for (size_t i = 0; i < feedback_buffers.size(); ++i)
+	{
+		size_t index = (feedback_next + i) % feedback_buffers.size();
+		if (feedback_fences[index] == NULL)
+			continue;
+
+		GLenum status = glClientWaitSync(feedback_fences[index], 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			continue;
+
+		glDeleteSync(feedback_fences[index]);
+		feedback_fences[index] = NULL;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, feedback_buffers[index]);
+		auto texels = static_cast<const uint32_t *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, feedback_counts[index] * sizeof(uint32_t), GL_MAP_READ_BIT));
+		if (texels != NULL)
+			ProcessFeedback(texels, feedback_counts[index]);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	/* Upload a bounded number of pages that arrived from disk */
+	for (int i = 0; i < uploads_per_frame; ++i)
+	{
+		std::pair<uint32_t, std::vector<unsigned char>> page;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (loaded.empty())
+				break;
+			page = std::move(loaded.front());
+			loaded.pop_front();
+		}
+
+		in_flight.erase(page.first);
+		if (!page.second.empty() && !resident.count(page.first))
+			UploadPage(page.first, page.second.data());
+	}
+
+	if (page_table_dirty)
+		RebuildPageTable();
+}
+
+uint32_t VirtualTexture::PageKey(uint32_t mip, uint32_t x, uint32_t y)
+{
+	// Same packing the feedback shader writes: 8 bits mip, 12 bits y, 12 bits x
+	return (mip << 24) | (y << 12) | x;
+}
+
+uint32_t VirtualTexture::PagesX(uint32_t mip) const
+{
+	return std::max(1u, header.pages_x >> mip);
+}
+
+uint32_t VirtualTexture::PagesY(uint32_t mip) const
+{
+	return std::max(1u, header.pages_y >> mip);
+}
+
+void VirtualTexture::RequestPage(uint32_t key)
+{
+	if (in_flight.count(key))
+		return;
+
+	in_flight.insert(key);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		load_queue.push_back(key);
+	}
+	work_available.notify_one();
+}
+
+void VirtualTexture::ProcessFeedback(const uint32_t * texels, size_t count)
+{
+	std::vector<uint32_t> keys(texels, texels + count);
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	// Coarse pages first: they cover more screen and are what finer misses fall back to
+	std::vector<uint32_t> missing;
+	for (auto key : keys)
+	{
+		if (key == UINT32_MAX)
+			continue;
+
+		uint32_t mip = key >> 24, y = (key >> 12) & 0xFFF, x = key & 0xFFF;
+		if (mip >= header.mip_count || x >= PagesX(mip) || y >= PagesY(mip))
+			continue;
+
+		// Walk up to the root so every ancestor in use counts as recently used too
+		for (; mip < header.mip_count; ++mip, x /= 2, y /= 2)
+		{
+			uint32_t page = PageKey(mip, x, y);
+			auto slot = resident.find(page);
+			if (slot == resident.end())
+				missing.push_back(page);
+			else if (slot_last_used[slot->second] != UINT64_MAX)
+				slot_last_used[slot->second] = frame;
+		}
+	}
+
+	std::sort(missing.begin(), missing.end(), std::greater<uint32_t>());
+	missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+	for (auto key : missing)
+		RequestPage(key);
+}
+
+void VirtualTexture::UploadPage(uint32_t key, const unsigned char * data)
+{
+	// A free slot if there is one, otherwise the least recently used page not wanted this frame
+	int slot = -1;
+	uint64_t oldest = UINT64_MAX;
+	for (size_t i = 0; i < slot_pages.size(); ++i)
+	{
+		if (slot_pages[i] == UINT32_MAX)
+		{
+			slot = int(i);
+			break;
+		}
+		if (slot_last_used[i] < frame && slot_last_used[i] < oldest)
+		{
+			oldest = slot_last_used[i];
+			slot = int(i);
+		}
+	}
+
+	// Atlas full of pages in use: this page waits until feedback asks for it again
+	if (slot < 0)
+		return;
+
+	if (slot_pages[slot] != UINT32_MAX)
+		resident.erase(slot_pages[slot]);
+
+	glBindTexture(GL_TEXTURE_2D, atlas_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % atlas_slots) * slot_size, (slot / atlas_slots) * slot_size,
+		slot_size, slot_size, GL_RGB, GL_UNSIGNED_BYTE, data);
+
+	resident[key] = slot;
+	slot_pages[slot] = key;
+	slot_last_used[slot] = frame;
+	page_table_dirty = true;
+}
+
+void VirtualTexture::RebuildPageTable()
+{
+	// Coarse to fine, so a page that is not resident can copy its parent's entry
+	for (int mip = int(header.mip_count) - 1; mip >= 0; --mip)
+		for (uint32_t y = 0; y < PagesY(mip); ++y)
+			for (uint32_t x = 0; x < PagesX(mip); ++x)
+			{
+				auto slot = resident.find(PageKey(mip, x, y));
+				uint32_t entry;
+				if (slot != resident.end())
+					entry = uint32_t(slot->second % atlas_slots) | (uint32_t(slot->second / atlas_slots) << 8) | (uint32_t(mip) << 16) | 0xFF000000u;
+				else
+					entry = page_table[mip + 1][(y / 2) * PagesX(mip + 1) + x / 2];
+				page_table[mip][y * PagesX(mip) + x] = entry;
+			}
+
+	glBindTexture(GL_TEXTURE_2D, page_table_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	for (uint32_t mip = 0; mip < header.mip_count; ++mip)
+		glTexSubImage2D(GL_TEXTURE_2D, mip, 0, 0, PagesX(mip), PagesY(mip), GL_RGBA, GL_UNSIGNED_BYTE, page_table[mip].data());
+
+	page_table_dirty = false;
+}
+
+bool VirtualTexture::ReadPage(uint32_t key, std::vector<unsigned char>& data) const
+{
+	uint32_t mip = key >> 24, y = (key >> 12) & 0xFFF, x = key & 0xFFF;
+	off_t offset = off_t(sizeof(VirtualTextureHeader) + (mip_first_page[mip] + uint64_t(y) * PagesX(mip) + x) * page_bytes);
+
+	data.resize(page_bytes);
+	return pread(file, data.data(), page_bytes, offset) == ssize_t(page_bytes);
+}
+
+void VirtualTexture::LoaderLoop()
+{
+	PROFILE_THREAD_NAME("Virtual texture loader");
+	for (;;)
+	{
+		uint32_t key;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_available.wait(lock, [this] { return stopping || !load_queue.empty(); });
+			if (stopping)
+				return;
+
+			key = load_queue.front();
+			load_queue.pop_front();
+		}
+
+		// An empty page tells Update the read failed, so the key can be requested again
+		std::vector<unsigned char> data;
+		PROFILE_BEGIN("Read page");
+		if (!ReadPage(key, data))
+			data.clear();
+		PROFILE_END();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		loaded.emplace_back(key, std::move(data));
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "glad/glad.h"
+
+/* Virtual Texture File Format */
+
+// ".vtex" files hold a tiled mip pyramid: a VirtualTextureHeader followed by every page of
+// mip 0 row by row, then every page of mip 1 and so on down to a single page. A page is
+// (page_size + 2 * page_border)^2 RGB texels, the border repeats the neighbouring texels so
+// bilinear filtering inside the atlas never reads another page. Page counts are powers of two.
+const uint32_t virtual_texture_magic = 0x5854564D; // "MVTX"
+const uint32_t virtual_texture_version = 1;
+
+struct VirtualTextureHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pages_x;
+	uint32_t pages_y;
+	uint32_t page_size;
+	uint32_t page_border;
+	uint32_t mip_count;
+	uint32_t reserved;
+};
+
+/* Virtual Texture */
+
+// Samples arbitrarily large imagery through a fixed size page atlas. A low resolution
+// feedback pass writes the page every pixel wants, it is read back a couple of frames later
+// without stalling, missing pages are read from disk on a loader thread and replace the
+// least recently used atlas slots. The page table points every virtual page at the finest
+// resident page covering it, so VRAM stays at atlas + page table whatever the source size.
+struct VirtualTexture
+{
+	static const GLint page_table_unit = 1;
+	static const GLint atlas_unit = 2;
+
+	int file;
+	VirtualTextureHeader header;
+	std::vector<uint64_t> mip_first_page;
+	size_t page_bytes;
+	int slot_size;
+
+	GLuint page_table_texture;
+	GLuint atlas_texture;
+	int atlas_slots;
+
+	// Atlas slots: which page each holds (UINT32_MAX when free) and when it was last wanted
+	std::vector<uint32_t> slot_pages;
+	std::vector<uint64_t> slot_last_used;
+	std::unordered_map<uint32_t, int> resident;
+	std::unordered_set<uint32_t> in_flight;
+
+	// CPU copy of the page table, one RGBA8 texel per page per mip: atlas slot x, y, resident mip
+	std::vector<std::vector<uint32_t>> page_table;
+	bool page_table_dirty;
+
+	GLuint feedback_framebuffer;
+	GLuint feedback_color;
+	GLuint feedback_depth;
+	int feedback_scale;
+	int feedback_width;
+	int feedback_height;
+	GLint saved_viewport[4];
+	GLint saved_framebuffer;
+
+	// Read back through a ring of pack buffers, each consumed once its fence has signaled
+	std::vector<GLuint> feedback_buffers;
+	std::vector<GLsync> feedback_fences;
+	std::vector<size_t> feedback_counts;
+	size_t feedback_next;
+
+	int uploads_per_frame;
+	uint64_t frame;
+
+	std::thread loader;
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::deque<uint32_t> load_queue;
+	std::deque<std::pair<uint32_t, std::vector<unsigned char>>> loaded;
+	bool stopping;
+
+	VirtualTexture();
+	~VirtualTexture();
+
+	VirtualTexture(const VirtualTexture&) = delete;
+	VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+	// Opens the tiled file and creates the GPU resources. atlas_size is in texels per side.
+	bool Open(const std::string& path, int atlas_size = 4096, int feedback_scale = 8, int uploads_per_frame = 16);
+
+	// Sets the VT uniforms of a program that uses MATERIAL_VIRTUAL_TEXTURE or VIRTUAL_TEXTURE_FEEDBACK
+	void SetupProgram(GLuint program, bool feedback) const;
+
+	void Bind() const;
+
+	// Redirects rendering to the feedback target, the caller draws the virtual textured objects in between
+	void BeginFeedback(int screen_width, int screen_height);
+	void EndFeedback();
+
+	// Once per frame: consume finished feedback, request and upload pages, refresh the page table
+	void Update();
+
+	static uint32_t PageKey(uint32_t mip, uint32_t x, uint32_t y);
+	uint32_t PagesX(uint32_t mip) const;
+	uint32_t PagesY(uint32_t mip) const;
+
+	void RequestPage(uint32_t key);
+	void ProcessFeedback(const uint32_t * texels, size_t count);
+	void UploadPage(uint32_t key, const unsigned char * data);
+	void RebuildPageTable();
+	bool ReadPage(uint32_t key, std::vector<unsigned char>& data) const;
+	void LoaderLoop();
+};